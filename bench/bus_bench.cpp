@@ -0,0 +1,162 @@
+// Memory held by a bus for its connections, and the latency of the lookups rooted at it, for small,
+// medium and huge buses.
+//
+// usage: xp_bus_bench [services...] (default: 4 64 10000)
+//
+// Each bus has an upper-level bus and a sibling bus, the services are connected one by one. The memory is
+// what the bus allocated to connect them, still held once connected (the services are not counted), in bytes
+// and in blocks.
+
+#include <xputil/impl_intfs.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <string>
+#include <vector>
+
+namespace {
+
+std::atomic<long long> live_bytes{0};
+std::atomic<long long> live_blocks{0};
+
+// allocated size, in front of each block
+constexpr std::size_t header = alignof(std::max_align_t);
+
+void* allocate(std::size_t size)
+{
+    auto p = static_cast<char*>(std::malloc(size + header));
+    if (!p) throw std::bad_alloc();
+    *reinterpret_cast<std::size_t*>(p) = size;
+    live_bytes += static_cast<long long>(size);
+    live_blocks++;
+    return p + header;
+}
+
+void release(void* ptr) noexcept
+{
+    if (!ptr) return;
+    auto p = static_cast<char*>(ptr) - header;
+    live_bytes -= static_cast<long long>(*reinterpret_cast<std::size_t*>(p));
+    live_blocks--;
+    std::free(p);
+}
+
+struct IService : public xp::IInterfaceEx {
+    DECLARE_IID("bench.IService");
+};
+
+// A service resolving its own runtime iid
+class Service : public xp::TInterfaceEx<IService, false>, public xp::IIntfManifest
+{
+public:
+    explicit Service(int n) : _iid(iid_of(n)) {}
+
+    static xp::TIntfId iid_of(int n)
+    {
+        return xp::calc_iid(("bench.service." + std::to_string(n)).c_str());
+    }
+
+    xp::xp_error_code queryInterfaceEx(xp::TIntfId iid, xp::IInterface** retIntf, xp::IQueryState& qst) override
+    {
+        if (xp::equalIID(iid, _iid)) {
+            this->ref();
+            *retIntf = this;
+            return xp::xp_error_code::OK;
+        }
+        qst.addSearched(this);
+        return this->searchBus(iid, retIntf, qst);
+    }
+    bool providedIids(std::span<const xp::TIntfId>& iids) const override
+    {
+        iids = {&_iid, 1};
+        return true;
+    }
+
+private:
+    xp::TIntfId _iid;
+};
+
+constexpr int lookups = 1000000;
+
+void run(int count)
+{
+    std::vector<xp::auto_ref<xp::IInterfaceEx>> services;
+    std::vector<xp::TIntfId> iids;
+    for (int i = 0; i < count; i++) {
+        services.emplace_back(static_cast<xp::IInterfaceEx*>(new Service(i)));
+        iids.push_back(Service::iid_of(i));
+    }
+    xp::auto_ref upper = new xp::TBus(1);
+    xp::auto_ref peer = new xp::TBus(0);
+
+    const auto before = live_bytes.load();
+    const auto blocks_before = live_blocks.load();
+    xp::auto_ref bus = new xp::TBus(0);
+    (void)bus->connect(upper);
+    (void)bus->connect(peer);
+    for (auto& s : services) (void)bus->connect(s.get());
+    const auto held = live_bytes.load() - before;
+    const auto blocks = live_blocks.load() - blocks_before;
+
+    // hits spread over the services, and misses
+    const auto miss = xp::calc_iid("bench.missing");
+    std::size_t found = 0;
+    const auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < lookups; i++) {
+        xp::IInterface* p{nullptr};
+        const auto iid = i % 4 == 3 ? miss : iids[static_cast<std::size_t>(i) * 7919 % iids.size()];
+        if (bus->queryInterface(iid, &p) == xp::xp_error_code::OK) {
+            found++;
+            p->unref();
+        }
+    }
+    const std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+
+    std::printf("%10d %16lld %10lld %16.1f %16.1f\n", count, held, blocks, static_cast<double>(held) / count, elapsed.count() / lookups);
+    if (found == 0) std::fprintf(stderr, "nothing resolved\n");
+
+    bus->finish();
+    peer->finish();
+    upper->finish();
+}
+
+} // namespace
+
+void* operator new(std::size_t size)
+{
+    return allocate(size);
+}
+void* operator new[](std::size_t size)
+{
+    return allocate(size);
+}
+void operator delete(void* p) noexcept
+{
+    release(p);
+}
+void operator delete[](void* p) noexcept
+{
+    release(p);
+}
+void operator delete(void* p, std::size_t) noexcept
+{
+    release(p);
+}
+void operator delete[](void* p, std::size_t) noexcept
+{
+    release(p);
+}
+
+int main(int argc, char* argv[])
+{
+    std::vector<int> counts;
+    for (int i = 1; i < argc; i++) counts.push_back(std::atoi(argv[i]));
+    if (counts.empty()) counts = {4, 64, 10000};
+
+    std::printf("%10s %16s %10s %16s %16s\n", "services", "bus (bytes)", "blocks", "per service", "lookup (ns)");
+    for (int count : counts) run(count);
+    return 0;
+}
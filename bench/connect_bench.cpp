@@ -0,0 +1,79 @@
+// Connects services to a bus one by one (connect) and at once (connectMany).
+//
+// usage: xp_connect_bench [counts...] (default: 10000 100000)
+//
+// connect() appends each service to the connection lists shared with the previous version: both are
+// linear, connectMany() publishing its services at once.
+
+#include <xputil/impl_intfs.h>
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+namespace {
+
+struct IService : public xp::IInterfaceEx {
+    DECLARE_IID("bench.IService");
+};
+
+// A service resolving its own runtime iid
+class Service : public xp::TInterfaceEx<IService, false>, public xp::IIntfManifest
+{
+public:
+    explicit Service(int n) : _iid(xp::calc_iid(("bench.service." + std::to_string(n)).c_str())) {}
+
+    bool providedIids(std::span<const xp::TIntfId>& iids) const override
+    {
+        iids = {&_iid, 1};
+        return true;
+    }
+
+private:
+    xp::TIntfId _iid;
+};
+
+// milliseconds taken by connecting count services
+template <typename F>
+double measure(int count, F&& connect)
+{
+    std::vector<xp::auto_ref<xp::IInterfaceEx>> services;
+    std::vector<xp::IInterfaceEx*> intfs;
+    services.reserve(count);
+    for (int i = 0; i < count; i++) {
+        services.emplace_back(static_cast<xp::IInterfaceEx*>(new Service(i)));
+        intfs.push_back(services.back().get());
+    }
+
+    xp::auto_ref bus = new xp::TBus(0);
+    const auto start = std::chrono::steady_clock::now();
+    const std::size_t connected = connect(bus.get(), intfs);
+    const std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+    bus->finish();
+
+    if (connected != intfs.size()) std::fprintf(stderr, "only %zu of %d connected\n", connected, count);
+    return elapsed.count();
+}
+
+} // namespace
+
+int main(int argc, char* argv[])
+{
+    std::vector<int> counts;
+    for (int i = 1; i < argc; i++) counts.push_back(std::atoi(argv[i]));
+    if (counts.empty()) counts = {10000, 100000};
+
+    std::printf("%10s %16s %16s\n", "services", "connect (ms)", "connectMany (ms)");
+    for (int count : counts) {
+        const double one_by_one = measure(count, [](xp::TBus* bus, const std::vector<xp::IInterfaceEx*>& intfs) {
+            std::size_t connected = 0;
+            for (auto intf : intfs) connected += bus->connect(intf) ? 1 : 0;
+            return connected;
+        });
+        const double at_once = measure(count, [](xp::TBus* bus, const std::vector<xp::IInterfaceEx*>& intfs) { return bus->connectMany(intfs); });
+        std::printf("%10d %16.1f %16.1f\n", count, one_by_one, at_once);
+    }
+    return 0;
+}
@@ -0,0 +1,142 @@
+// Queries a mesh of sibling buses from one thread, then from several threads at once.
+//
+// usage: xp_mesh_bench [threads] (default: the hardware concurrency, up to 8)
+//
+// The readers do not serialize on any bus lock, the queries per second grow with the threads (the
+// reference counts of the providers are still shared).
+
+#include <xputil/impl_intfs.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+struct IStation : public xp::IInterfaceEx {
+    DECLARE_IID("bench.IStation");
+    virtual int number() const = 0;
+};
+
+// One of many stations, each resolved by its own runtime iid
+class Station : public xp::TInterfaceEx<IStation, false>, public xp::IIntfManifest
+{
+public:
+    explicit Station(int n) : _n(n), _iid(iid_of(n)) {}
+
+    static xp::TIntfId iid_of(int n)
+    {
+        return xp::calc_iid(("bench.station." + std::to_string(n)).c_str());
+    }
+
+    int number() const override { return _n; }
+
+    xp::xp_error_code queryInterfaceEx(xp::TIntfId iid, xp::IInterface** retIntf, xp::IQueryState& qst) override
+    {
+        if (xp::equalIID(iid, _iid)) {
+            this->ref();
+            *retIntf = static_cast<IStation*>(this);
+            return xp::xp_error_code::OK;
+        }
+        return xp::TInterfaceEx<IStation, false>::queryInterfaceEx(iid, retIntf, qst);
+    }
+    bool providedIids(std::span<const xp::TIntfId>& iids) const override
+    {
+        iids = {&_iid, 1};
+        return true;
+    }
+
+private:
+    int _n;
+    xp::TIntfId _iid;
+};
+
+// does not advertise its IIDs, queries walk the graph instead of using a compiled snapshot
+struct Hidden : xp::TInterfaceEx<IStation, false> {
+    int number() const override { return -1; }
+};
+
+int resolve_station(xp::IBus* bus, int n)
+{
+    xp::IInterface* p{nullptr};
+    if (bus->queryInterface(Station::iid_of(n), &p) != xp::xp_error_code::OK) return -1;
+    const int found = static_cast<IStation*>(p)->number();
+    p->unref();
+    return found;
+}
+
+// [0,0] sibling mesh, each bus hosting a station with its own number
+struct Mesh {
+    std::vector<xp::auto_ref<xp::TBus>> buses;
+
+    Mesh(int size, bool compiled)
+    {
+        for (int i = 0; i < size; i++) {
+            buses.emplace_back(new xp::TBus(0));
+            buses[i]->connect(new Station(i));
+            if (!compiled) buses[i]->connect(new Hidden());
+        }
+        for (int i = 0; i < size; i++) {
+            for (int j = i + 1; j < size; j++) buses[i]->connect(buses[j].get());
+        }
+    }
+    Mesh(const Mesh&) = delete;
+    Mesh& operator=(const Mesh&) = delete;
+    ~Mesh()
+    {
+        for (auto& bus : buses) bus->finish();
+    }
+};
+
+// Every thread queries every station from every bus of the mesh, returns the number of queries per second.
+double query_rate(Mesh& mesh, int threads, int rounds, std::atomic<int>& errors)
+{
+    const int size = static_cast<int>(mesh.buses.size());
+    const auto start = std::chrono::steady_clock::now();
+
+    std::vector<std::thread> workers;
+    for (int t = 0; t < threads; t++) {
+        workers.emplace_back([&, t] {
+            for (int r = 0; r < rounds; r++) {
+                for (int i = 0; i < size; i++) {
+                    // threads start from opposite sides of the mesh
+                    const int from = (i + t) % size;
+                    const int n = (size - i + r) % size;
+                    if (resolve_station(mesh.buses[from].get(), n) != n) errors++;
+                }
+            }
+        });
+    }
+    for (auto& w : workers) w.join();
+
+    const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    return static_cast<double>(threads) * rounds * size / elapsed.count();
+}
+
+constexpr int mesh_size = 8;
+constexpr int rounds = 20000;
+
+} // namespace
+
+int main(int argc, char* argv[])
+{
+    int threads = argc > 1 ? std::atoi(argv[1]) : static_cast<int>(std::min(8U, std::thread::hardware_concurrency()));
+    threads = std::max(threads, 1);
+
+    std::printf("%10s %16s %16s\n", "compiled", "1 thread (q/s)", "threads (q/s)");
+    for (bool compiled : {true, false}) {
+        Mesh mesh(mesh_size, compiled);
+        std::atomic<int> errors{0};
+        const double serial = query_rate(mesh, 1, rounds, errors);
+        const double parallel = query_rate(mesh, threads, rounds, errors);
+        std::printf("%10s %16.0f %16.0f\n", compiled ? "yes" : "no", serial, parallel);
+        if (errors != 0) std::fprintf(stderr, "%d wrong providers\n", errors.load());
+    }
+    std::printf("(%d threads)\n", threads);
+    return 0;
+}
@@ -0,0 +1,343 @@
+// Resolution cost of TBus as a function of the topology, reported as JSON for regression comparison.
+//
+// usage: xp_topology_bench [--scale N] [--queries N] [--threads N] [--out file] [scenario...]
+//
+// Scenarios (sizes multiplied by --scale, all of them by default):
+//   wide   one bus with 10000 services
+//   deep   a cascade of 64 buses of increasing levels (0 -> 1 -> ... -> 63), 16 services each
+//   mesh   32 sibling buses of the same level, all connected to each other, 64 services each
+//   mixed  an application bus, 8 module buses (siblings in pairs) sharing a utility bus, 10% of the
+//          services not advertising their IIDs (the graph cannot be compiled)
+//
+// Each scenario reports:
+//   connect_ns     mean cost of connecting a service, the graph being built
+//   hit_ns         latency percentiles of queries resolved from the root bus
+//   miss_ns        latency percentiles of queries for an IID nobody provides
+//   disconnect_ns  mean cost of disconnecting a service and connecting it back
+//   mt_qps         hit queries per second, --threads threads querying the root bus together
+//   finish_ms      time taken by finishing the buses
+//
+// Latencies are timed one query at a time, the clock overhead (~20ns) is included.
+
+#include <xputil/impl_intfs.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+using clock_type = std::chrono::steady_clock;
+
+struct IService : public xp::IInterfaceEx {
+    DECLARE_IID("bench.IService");
+};
+
+// A service resolving its own runtime iid, advertised or not
+class Service : public xp::TInterfaceEx<IService, false>, public xp::IIntfManifest
+{
+public:
+    Service(int n, bool advertised) : _iid(iid_of(n)), _advertised(advertised) {}
+
+    static xp::TIntfId iid_of(int n)
+    {
+        return xp::calc_iid(("bench.service." + std::to_string(n)).c_str());
+    }
+
+    xp::xp_error_code queryInterfaceEx(xp::TIntfId iid, xp::IInterface** retIntf, xp::IQueryState& qst) override
+    {
+        if (xp::equalIID(iid, _iid)) {
+            this->ref();
+            *retIntf = this;
+            return xp::xp_error_code::OK;
+        }
+        qst.addSearched(this);
+        return this->searchBus(iid, retIntf, qst);
+    }
+    bool providedIids(std::span<const xp::TIntfId>& iids) const override
+    {
+        if (!_advertised) return false;
+        iids = {&_iid, 1};
+        return true;
+    }
+
+private:
+    xp::TIntfId _iid;
+    bool _advertised;
+};
+
+struct options {
+    int scale{1};
+    int queries{200000};
+    int threads{4};
+    std::string out{};
+    std::vector<std::string> scenarios{};
+};
+
+struct percentiles {
+    double p50, p90, p99, max;
+};
+
+// A generated bus graph: buses[0] is the root, queries are rooted there.
+struct graph {
+    std::vector<xp::auto_ref<xp::TBus>> buses;
+    std::vector<xp::auto_ref<xp::IInterfaceEx>> services;
+    std::vector<std::size_t> hosts; // bus of each service
+    std::vector<xp::TIntfId> iids;  // resolved from the root, one per service
+
+    void add_bus(int level)
+    {
+        buses.emplace_back(new xp::TBus(level));
+    }
+    void add_services(std::size_t bus, int count, int hidden_percent = 0)
+    {
+        for (int i = 0; i < count; i++) {
+            const int n = static_cast<int>(services.size());
+            services.emplace_back(static_cast<xp::IInterfaceEx*>(new Service(n, n % 100 >= hidden_percent)));
+            hosts.push_back(bus);
+            iids.push_back(Service::iid_of(n));
+        }
+    }
+};
+
+struct result {
+    std::string name;
+    std::size_t buses{0};
+    std::size_t services{0};
+    double connect_ns{0};
+    percentiles hit{};
+    percentiles miss{};
+    double disconnect_ns{0};
+    int threads{0};
+    double mt_qps{0};
+    double finish_ms{0};
+};
+
+double ns_since(clock_type::time_point start)
+{
+    return std::chrono::duration<double, std::nano>(clock_type::now() - start).count();
+}
+
+percentiles percentiles_of(std::vector<double>& samples)
+{
+    std::sort(samples.begin(), samples.end());
+    auto at = [&samples](double q) { return samples[static_cast<std::size_t>(q * static_cast<double>(samples.size() - 1))]; };
+    return {at(0.50), at(0.90), at(0.99), samples.back()};
+}
+
+bool resolve(xp::TBus* bus, xp::TIntfId iid)
+{
+    xp::IInterface* p{nullptr};
+    if (bus->queryInterface(iid, &p) != xp::xp_error_code::OK) return false;
+    p->unref();
+    return true;
+}
+
+// The topology is built first (links), then the services are connected: only the latter is measured.
+template <typename Links>
+result run(const std::string& name, graph& g, Links&& link, const options& opt)
+{
+    result r;
+    r.name = name;
+    link(g);
+    r.buses = g.buses.size();
+    r.services = g.services.size();
+
+    auto start = clock_type::now();
+    for (std::size_t i = 0; i < g.services.size(); i++) (void)g.buses[g.hosts[i]]->connect(g.services[i].get());
+    r.connect_ns = ns_since(start) / static_cast<double>(g.services.size());
+
+    xp::TBus* root = g.buses[0].get();
+    std::mt19937 rng(20240601);
+    std::uniform_int_distribution<std::size_t> pick(0, g.iids.size() - 1);
+
+    std::vector<double> samples(static_cast<std::size_t>(opt.queries));
+    std::size_t unresolved = 0;
+    for (auto& t : samples) {
+        const auto iid = g.iids[pick(rng)];
+        start = clock_type::now();
+        if (!resolve(root, iid)) unresolved++;
+        t = ns_since(start);
+    }
+    r.hit = percentiles_of(samples);
+
+    const auto missing = xp::calc_iid("bench.missing");
+    for (auto& t : samples) {
+        start = clock_type::now();
+        if (resolve(root, missing)) unresolved++;
+        t = ns_since(start);
+    }
+    r.miss = percentiles_of(samples);
+
+    r.threads = opt.threads;
+    std::vector<std::thread> threads;
+    const int per_thread = opt.queries / std::max(opt.threads, 1);
+    start = clock_type::now();
+    for (int t = 0; t < opt.threads; t++) {
+        threads.emplace_back([&g, root, per_thread, t] {
+            std::mt19937 local(static_cast<unsigned>(t));
+            std::uniform_int_distribution<std::size_t> any(0, g.iids.size() - 1);
+            for (int i = 0; i < per_thread; i++) (void)resolve(root, g.iids[any(local)]);
+        });
+    }
+    for (auto& t : threads) t.join();
+    r.mt_qps = static_cast<double>(per_thread) * opt.threads / (ns_since(start) / 1e9);
+
+    // disconnecting retires the caches of the graph: measured over a sample of the services
+    const std::size_t churn = std::min<std::size_t>(g.services.size(), 1000);
+    start = clock_type::now();
+    for (std::size_t k = 0; k < churn; k++) {
+        const auto i = k * g.services.size() / churn;
+        auto bus = g.buses[g.hosts[i]].get();
+        bus->disconnect(g.services[i].get());
+        (void)bus->connect(g.services[i].get());
+    }
+    r.disconnect_ns = ns_since(start) / static_cast<double>(churn);
+
+    start = clock_type::now();
+    for (auto& bus : g.buses) bus->finish();
+    r.finish_ms = ns_since(start) / 1e6;
+
+    if (unresolved > 0) std::fprintf(stderr, "%s: %zu unexpected query results\n", name.c_str(), unresolved);
+    return r;
+}
+
+result wide(const options& opt)
+{
+    graph g;
+    return run("wide", g, [&opt](graph& g) {
+        g.add_bus(0);
+        g.add_services(0, 10000 * opt.scale);
+    }, opt);
+}
+
+result deep(const options& opt)
+{
+    graph g;
+    return run("deep", g, [&opt](graph& g) {
+        const int levels = 64 * opt.scale;
+        for (int level = 0; level < levels; level++) {
+            g.add_bus(level);
+            g.add_services(static_cast<std::size_t>(level), 16);
+            if (level > 0) (void)g.buses[static_cast<std::size_t>(level) - 1]->connect(g.buses.back().get());
+        }
+    }, opt);
+}
+
+result mesh(const options& opt)
+{
+    graph g;
+    return run("mesh", g, [&opt](graph& g) {
+        const int peers = 32 * opt.scale;
+        for (int i = 0; i < peers; i++) {
+            g.add_bus(0);
+            g.add_services(static_cast<std::size_t>(i), 64);
+        }
+        for (int i = 0; i < peers; i++) {
+            for (int k = i + 1; k < peers; k++) (void)g.buses[static_cast<std::size_t>(i)]->connect(g.buses[static_cast<std::size_t>(k)].get());
+        }
+    }, opt);
+}
+
+result mixed(const options& opt)
+{
+    graph g;
+    return run("mixed", g, [&opt](graph& g) {
+        constexpr int hidden = 10;
+        const int modules = 8 * opt.scale;
+        g.add_bus(0);
+        g.add_services(0, 500, hidden);
+        const auto util = static_cast<std::size_t>(modules) + 1;
+        for (int m = 1; m <= modules; m++) {
+            g.add_bus(1);
+            g.add_services(static_cast<std::size_t>(m), 200, hidden);
+        }
+        g.add_bus(2);
+        g.add_services(util, 500, hidden);
+
+        for (int m = 1; m <= modules; m++) {
+            auto module = g.buses[static_cast<std::size_t>(m)].get();
+            (void)g.buses[0]->connect(module);
+            (void)module->connect(g.buses[util].get());
+            if (m % 2 == 0) (void)module->connect(g.buses[static_cast<std::size_t>(m) - 1].get());
+        }
+    }, opt);
+}
+
+void print(std::FILE* f, const result& r, bool last)
+{
+    auto p = [f](const char* name, const percentiles& x) {
+        std::fprintf(f, "      \"%s\": {\"p50\": %.1f, \"p90\": %.1f, \"p99\": %.1f, \"max\": %.1f},\n", name, x.p50, x.p90, x.p99, x.max);
+    };
+    std::fprintf(f, "    {\n");
+    std::fprintf(f, "      \"name\": \"%s\",\n", r.name.c_str());
+    std::fprintf(f, "      \"buses\": %zu,\n", r.buses);
+    std::fprintf(f, "      \"services\": %zu,\n", r.services);
+    std::fprintf(f, "      \"connect_ns\": %.1f,\n", r.connect_ns);
+    p("hit_ns", r.hit);
+    p("miss_ns", r.miss);
+    std::fprintf(f, "      \"disconnect_ns\": %.1f,\n", r.disconnect_ns);
+    std::fprintf(f, "      \"threads\": %d,\n", r.threads);
+    std::fprintf(f, "      \"mt_qps\": %.0f,\n", r.mt_qps);
+    std::fprintf(f, "      \"finish_ms\": %.3f\n", r.finish_ms);
+    std::fprintf(f, "    }%s\n", last ? "" : ",");
+}
+
+} // namespace
+
+int main(int argc, char* argv[])
+{
+    options opt;
+    for (int i = 1; i < argc; i++) {
+        const std::string arg = argv[i];
+        const bool has_value = i + 1 < argc;
+        if (arg == "--scale" && has_value) {
+            opt.scale = std::max(1, std::atoi(argv[++i]));
+        } else if (arg == "--queries" && has_value) {
+            opt.queries = std::max(1, std::atoi(argv[++i]));
+        } else if (arg == "--threads" && has_value) {
+            opt.threads = std::max(1, std::atoi(argv[++i]));
+        } else if (arg == "--out" && has_value) {
+            opt.out = argv[++i];
+        } else if (arg.starts_with("--")) {
+            std::fprintf(stderr, "usage: %s [--scale N] [--queries N] [--threads N] [--out file] [wide|deep|mesh|mixed...]\n", argv[0]);
+            return 1;
+        } else {
+            opt.scenarios.push_back(arg);
+        }
+    }
+    if (opt.scenarios.empty()) opt.scenarios = {"wide", "deep", "mesh", "mixed"};
+
+    std::vector<result> results;
+    for (const auto& name : opt.scenarios) {
+        if (name == "wide") {
+            results.push_back(wide(opt));
+        } else if (name == "deep") {
+            results.push_back(deep(opt));
+        } else if (name == "mesh") {
+            results.push_back(mesh(opt));
+        } else if (name == "mixed") {
+            results.push_back(mixed(opt));
+        } else {
+            std::fprintf(stderr, "unknown scenario: %s\n", name.c_str());
+            return 1;
+        }
+    }
+
+    std::FILE* f = opt.out.empty() ? stdout : std::fopen(opt.out.c_str(), "w");
+    if (!f) {
+        std::fprintf(stderr, "cannot write %s\n", opt.out.c_str());
+        return 1;
+    }
+    std::fprintf(f, "{\n  \"scale\": %d,\n  \"queries\": %d,\n  \"scenarios\": [\n", opt.scale, opt.queries);
+    for (std::size_t i = 0; i < results.size(); i++) print(f, results[i], i + 1 == results.size());
+    std::fprintf(f, "  ]\n}\n");
+    if (f != stdout) std::fclose(f);
+    return 0;
+}
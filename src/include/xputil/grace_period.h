@@ -0,0 +1,112 @@
+#ifndef XP_GRACE_PERIOD_H
+#define XP_GRACE_PERIOD_H
+
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace xp::detail {
+
+/**
+ * Read-side sections of an RCU-protected object, and grace periods waiting for them.
+ *
+ * Readers never block: enter() and leave() are two atomic increments (unless the reader defer()red work from
+ * within its section, done when leaving it). synchronize() returns once every read-side section entered
+ * before the call has been left, i.e. no reader can still see what was unpublished before it. Readers are
+ * counted in two alternating slots so that new readers cannot delay a grace period forever.
+ */
+class grace_period
+{
+public:
+    class reader
+    {
+    public:
+        explicit reader(grace_period& gp) : _gp(gp), _slot(gp.enter()) {}
+        reader(const reader&) = delete;
+        reader& operator=(const reader&) = delete;
+        ~reader()
+        {
+            _gp.leave(_slot);
+        }
+
+    private:
+        grace_period& _gp;
+        unsigned _slot;
+    };
+
+    unsigned enter()
+    {
+        const unsigned slot = _phase.load() & 1;
+        _readers[slot].fetch_add(1);
+        _entered.push_back(this);
+        return slot;
+    }
+    void leave(unsigned slot)
+    {
+        _entered.pop_back(); // sections are scoped: the last one entered is left first
+        _readers[slot].fetch_sub(1);
+        if (!_deferred.empty() && std::find(_entered.begin(), _entered.end(), this) == _entered.end()) reclaim();
+    }
+
+    // Does not wait if the current thread is itself inside a read-side section of this object, which
+    // would never be left, returns false then. Sections of other objects do not matter.
+    bool synchronize()
+    {
+        if (std::find(_entered.begin(), _entered.end(), this) != _entered.end()) return false;
+
+        std::lock_guard lock(_mutex);
+        // Twice: a reader may have sampled the phase just before it was flipped.
+        for (int i = 0; i < 2; i++) {
+            const unsigned slot = _phase.fetch_xor(1) & 1;
+            while (_readers[slot].load() != 0) std::this_thread::yield();
+        }
+        return true;
+    }
+
+    // Runs done after a grace period: once the current thread has left its outermost read-side section of
+    // this object, if inside one (the readers of other threads are waited for then), now otherwise.
+    void defer(std::function<void()> done)
+    {
+        if (synchronize()) {
+            done();
+            return;
+        }
+        _deferred.emplace_back(this, std::move(done));
+    }
+
+private:
+    std::atomic<unsigned> _phase{0};
+    std::atomic<int> _readers[2]{};
+    std::mutex _mutex;
+
+    // read-side sections the current thread is in, of any object, innermost last
+    static inline thread_local std::vector<const grace_period*> _entered{};
+    // defer()red by the current thread from within its sections, by object
+    static inline thread_local std::vector<std::pair<const grace_period*, std::function<void()>>> _deferred{};
+
+    // Runs what was deferred on this object, the last thing done with it: it might be released by then.
+    void reclaim()
+    {
+        std::vector<std::function<void()>> due;
+        for (auto it = _deferred.begin(); it != _deferred.end();) {
+            if (it->first == this) {
+                due.push_back(std::move(it->second));
+                it = _deferred.erase(it);
+            } else {
+                ++it;
+            }
+        }
+        if (due.empty()) return;
+
+        synchronize();
+        for (auto& done : due) done();
+    }
+};
+
+} // namespace xp::detail
+
+#endif
@@ -0,0 +1,127 @@
+#ifndef XP_IID_FIND_H
+#define XP_IID_FIND_H
+
+#include "intf_defs.h"
+
+#include <array>
+#include <bit>
+#include <cstdint>
+#include <span>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define XP_IID_FIND_AVX2
+#elif defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define XP_IID_FIND_SSE2
+#endif
+
+namespace xp::detail {
+
+/**
+ * Position of the first occurrence of iid in a contiguous IID array, iids.size() if not found.
+ *
+ * 64 bit IIDs are compared 8 at a time (one cache line) with AVX2 or SSE2, the tail and the other
+ * targets use a plain loop.
+ */
+inline std::size_t find_iid(std::span<const TIntfId> iids, TIntfId iid)
+{
+    const TIntfId* data = iids.data();
+    const std::size_t n = iids.size();
+    std::size_t i = 0;
+
+    if constexpr (sizeof(TIntfId) == sizeof(std::uint64_t)) {
+#if defined(XP_IID_FIND_AVX2)
+        const __m256i key = _mm256_set1_epi64x(static_cast<long long>(iid));
+        for (; i + 8 <= n; i += 8) {
+            const __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i));
+            const __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i + 4));
+            const auto ma = static_cast<unsigned>(_mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpeq_epi64(a, key))));
+            const auto mb = static_cast<unsigned>(_mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpeq_epi64(b, key))));
+            if (const auto m = ma | (mb << 4); m != 0) return i + std::countr_zero(m);
+        }
+#elif defined(XP_IID_FIND_SSE2)
+        const __m128i key = _mm_set1_epi64x(static_cast<long long>(iid));
+        for (; i + 8 <= n; i += 8) {
+            unsigned m = 0;
+            for (unsigned k = 0; k < 4; k++) {
+                const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i + 2 * k));
+                // no 64 bit compare in SSE2: a lane matches if both of its 32 bit halves do.
+                __m128i eq = _mm_cmpeq_epi32(v, key);
+                eq = _mm_and_si128(eq, _mm_shuffle_epi32(eq, _MM_SHUFFLE(2, 3, 0, 1)));
+                m |= static_cast<unsigned>(_mm_movemask_pd(_mm_castsi128_pd(eq))) << (2 * k);
+            }
+            if (m != 0) return i + std::countr_zero(m);
+        }
+#endif
+    }
+
+    for (; i < n; i++) {
+        if (data[i] == iid) return i;
+    }
+    return n;
+}
+
+/**
+ * Bloom filter summarizing a set of IIDs, may_contain() never gives a false negative.
+ *
+ * A saturated filter stands for a set which cannot be enumerated, it may contain anything.
+ */
+class iid_filter
+{
+public:
+    void add(TIntfId iid)
+    {
+        const auto h = mix(iid);
+        for (unsigned k = 0; k < hashes; k++) {
+            const auto bit = slot(h, k);
+            _words[bit / 64] |= std::uint64_t{1} << (bit % 64);
+        }
+    }
+    void merge(const iid_filter& other)
+    {
+        _saturated = _saturated || other._saturated;
+        for (std::size_t i = 0; i < _words.size(); i++) _words[i] |= other._words[i];
+    }
+    void saturate()
+    {
+        _saturated = true;
+    }
+    bool saturated() const
+    {
+        return _saturated;
+    }
+    bool may_contain(TIntfId iid) const
+    {
+        if (_saturated) return true;
+
+        const auto h = mix(iid);
+        for (unsigned k = 0; k < hashes; k++) {
+            const auto bit = slot(h, k);
+            if ((_words[bit / 64] & (std::uint64_t{1} << (bit % 64))) == 0) return false;
+        }
+        return true;
+    }
+
+private:
+    static constexpr unsigned bits_log2 = 11;
+    static constexpr std::size_t bits = std::size_t{1} << bits_log2;
+    static constexpr unsigned hashes = 3;
+
+    static std::uint64_t mix(TIntfId iid)
+    {
+        return static_cast<std::uint64_t>(iid) * 0x9E3779B97F4A7C15ULL; // Fibonacci hashing
+    }
+    // k-th hash: k-th group of bits_log2 bits from the top of the mixed IID
+    static std::size_t slot(std::uint64_t h, unsigned k)
+    {
+        return static_cast<std::size_t>(h >> (64 - bits_log2 * (k + 1))) & (bits - 1);
+    }
+
+    std::array<std::uint64_t, bits / 64> _words{};
+    bool _saturated{false};
+};
+
+} // namespace xp::detail
+
+#endif
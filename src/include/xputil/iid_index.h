@@ -0,0 +1,202 @@
+#ifndef XP_IID_INDEX_H
+#define XP_IID_INDEX_H
+
+#include "intf_defs.h"
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cstdint>
+#include <memory>
+#include <utility>
+
+namespace xp::detail {
+
+/**
+ * IID => position map in one flat array (open addressing, linear probing).
+ *
+ * A lookup probes adjacent slots. Erasing shifts the following entries back: no tombstones, lookups stay short.
+ *
+ * The array is shared with the copies of the map, like a shared_vector: a copy takes a constant time, so does
+ * inserting a new IID into the last copy, which fills an empty slot in place. The other copies skip it, if they
+ * probe it, as long as they ignore the positions past their own entries. Any other change to a shared array is made
+ * to a copy of its own. The copies may be read while the last one is inserted into by one thread at a time.
+ */
+class iid_index
+{
+public:
+    iid_index() = default;
+    iid_index(const iid_index& other) : _table(other._table), _slots(other._slots), _bits(other._bits), _size(other._size)
+    {
+        if (_table) _table->shared = true;
+    }
+    iid_index(iid_index&& other) noexcept
+    {
+        *this = std::move(other);
+    }
+    iid_index& operator=(const iid_index& other)
+    {
+        if (this != &other) *this = iid_index(other);
+        return *this;
+    }
+    iid_index& operator=(iid_index&& other) noexcept
+    {
+        if (this == &other) return *this;
+        _table = std::move(other._table);
+        _slots = std::exchange(other._slots, nullptr);
+        _bits = std::exchange(other._bits, 0);
+        _size = std::exchange(other._size, 0);
+        return *this;
+    }
+    ~iid_index() = default;
+
+    bool empty() const
+    {
+        return _size == 0;
+    }
+    std::size_t size() const
+    {
+        return _size;
+    }
+    void clear()
+    {
+        _table.reset();
+        _slots = nullptr;
+        _bits = 0;
+        _size = 0;
+    }
+
+    // room for n entries without rehashing
+    void reserve(std::size_t n)
+    {
+        if (n * 4 > capacity() * 3) rehash(std::bit_width(n + n / 3));
+    }
+
+    const std::size_t* find(TIntfId iid) const
+    {
+        if (_size == 0) return nullptr;
+        for (auto i = home(iid);; i = next(i)) {
+            const auto& s = _slots[i];
+            if (position(s) == npos) return nullptr;
+            if (s.iid == iid) return &s.pos;
+        }
+    }
+    std::size_t* find(TIntfId iid)
+    {
+        if (!std::as_const(*this).find(iid)) return nullptr;
+        own();
+        return const_cast<std::size_t*>(std::as_const(*this).find(iid));
+    }
+
+    // Indexes iid at pos unless already indexed: the position indexed, and whether it has been inserted.
+    std::pair<std::size_t*, bool> try_emplace(TIntfId iid, std::size_t pos)
+    {
+        if (auto found = find(iid)) return {found, false};
+
+        reserve(_size + 1);
+        if (_table->shared && _table->used != _size) own();
+        auto i = home(iid);
+        while (position(_slots[i]) != npos) i = next(i);
+        // the IID first: a copy reading the slot meanwhile sees it empty, or filled
+        _slots[i].iid = iid;
+        std::atomic_ref(_slots[i].pos).store(pos, std::memory_order_release);
+        _table->used = ++_size;
+        return {&_slots[i].pos, true};
+    }
+
+    bool erase(TIntfId iid)
+    {
+        if (!std::as_const(*this).find(iid)) return false;
+        own();
+
+        auto hole = home(iid);
+        while (_slots[hole].iid != iid) hole = next(hole);
+        // moves back the entries of the cluster which would not be found past the hole
+        for (auto i = next(hole); _slots[i].pos != npos; i = next(i)) {
+            const auto h = home(_slots[i].iid);
+            const bool reachable = hole <= i ? (hole < h && h <= i) : (hole < h || h <= i);
+            if (!reachable) {
+                _slots[hole] = _slots[i];
+                hole = i;
+            }
+        }
+        _slots[hole].pos = npos;
+        _table->used = --_size;
+        return true;
+    }
+
+    // f(iid, position&) for each entry, which may change the position but not erase it
+    template <typename F>
+    void for_each(F&& f)
+    {
+        if (_size == 0) return;
+        own();
+        for (std::size_t i = 0; i < capacity(); i++) {
+            if (_slots[i].pos != npos) f(std::as_const(_slots[i].iid), _slots[i].pos);
+        }
+    }
+
+private:
+    static constexpr std::size_t npos = ~std::size_t{0}; // empty slot
+
+    struct slot {
+        TIntfId iid{};
+        std::size_t pos{npos};
+    };
+    struct table {
+        std::unique_ptr<slot[]> slots;
+        std::size_t used{0}; // size of the copy inserted into last
+        bool shared{false};  // copied: only inserted into since
+    };
+    std::shared_ptr<table> _table{};
+    slot* _slots{nullptr}; // 2^_bits, at most 3/4 full
+    unsigned _bits{0};
+    std::size_t _size{0};
+
+    std::size_t capacity() const
+    {
+        return _slots ? std::size_t{1} << _bits : 0;
+    }
+    std::size_t home(TIntfId iid) const
+    {
+        return static_cast<std::size_t>((static_cast<std::uint64_t>(iid) * 0x9E3779B97F4A7C15ULL) >> (64 - _bits));
+    }
+    std::size_t next(std::size_t i) const
+    {
+        return (i + 1) & (capacity() - 1);
+    }
+    // the position in a slot, which might be filled meanwhile if shared
+    static std::size_t position(const slot& s)
+    {
+        return std::atomic_ref(const_cast<std::size_t&>(s.pos)).load(std::memory_order_acquire);
+    }
+
+    void own()
+    {
+        if (_table->shared) rehash(_bits);
+    }
+    void rehash(unsigned bits)
+    {
+        const auto old = _slots;
+        const auto old_capacity = capacity();
+        auto t = std::make_shared<table>(table{std::make_unique<slot[]>(std::size_t{1} << bits)});
+        _slots = t->slots.get();
+        if (bits == _bits) {
+            std::copy(old, old + old_capacity, _slots);
+        } else {
+            _bits = bits;
+            for (std::size_t k = 0; k < old_capacity; k++) {
+                if (old[k].pos == npos) continue;
+                auto i = home(old[k].iid);
+                while (_slots[i].pos != npos) i = next(i);
+                _slots[i] = old[k];
+            }
+        }
+        t->used = _size;
+        _table = std::move(t); // the old one, if not shared, goes away last
+    }
+};
+
+} // namespace xp::detail
+
+#endif
@@ -0,0 +1,169 @@
+#ifndef XP_IID_MANIFEST_H
+#define XP_IID_MANIFEST_H
+
+#include "intf_defs.h"
+#include "mapped_file.h"
+#include "on_exit.h"
+
+#include <cstddef>
+#include <cstring>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#if defined(__linux__)
+#include <elf.h>
+#endif
+
+/**
+ * \file
+ * \brief IID manifests embedded in ELF binaries
+ *
+ * A plugin library lists the interfaces it provides in a dedicated section of its binary:
+ *
+ * \code
+ * XP_IID_MANIFEST(IBark);
+ * XP_IID_MANIFEST(IRun);
+ * \endcode
+ *
+ * so that a host can tell what it provides by reading the file, without loading it:
+ *
+ * \code
+ * if (auto names = xp::read_iid_manifest("plugins/libbark.so"); names) {...}
+ * \endcode
+ *
+ * Only ELF binaries (linux) carry a manifest, XP_IID_MANIFEST() is a no-op on other targets.
+ */
+
+namespace xp {
+
+namespace detail {
+
+// One entry of the manifest section: the DECLARE_IID() string of an interface.
+struct alignas(8) iid_record {
+    static constexpr char signature[8] = {'x', 'p', '.', 'i', 'i', 'd', '.', '1'};
+
+    char magic[8];
+    char name[120]; // null-terminated
+};
+static_assert(sizeof(iid_record) == 128);
+
+constexpr iid_record make_iid_record(const char* name)
+{
+    iid_record r{};
+    for (std::size_t i = 0; i < sizeof(r.magic); i++) r.magic[i] = iid_record::signature[i];
+    for (std::size_t i = 0; name[i]; i++) {
+        if (i + 1 >= sizeof(r.name)) throw std::length_error("iid string too long for the manifest");
+        r.name[i] = name[i];
+    }
+    return r;
+}
+
+} // namespace detail
+
+#define XP_IID_MANIFEST_SECTION "xp_iids"
+
+#if defined(__linux__)
+#if defined(__has_attribute)
+#if __has_attribute(retain)
+#define XP_IID_MANIFEST_RETAIN , retain // kept by --gc-sections
+#endif
+#endif
+#ifndef XP_IID_MANIFEST_RETAIN
+#define XP_IID_MANIFEST_RETAIN
+#endif
+#define XP_IID_MANIFEST_RECORD(var, intf)                                                                                 \
+    static constexpr xp::detail::iid_record var __attribute__((used, section(XP_IID_MANIFEST_SECTION) XP_IID_MANIFEST_RETAIN)) = \
+        xp::detail::make_iid_record(intf::iid_name())
+#else
+#define XP_IID_MANIFEST_RECORD(var, intf) static_assert(sizeof(intf::iid_name()) > 0)
+#endif
+
+// Lists an interface in the IID manifest of the binary, at namespace scope.
+#define XP_IID_MANIFEST(intf) XP_IID_MANIFEST_RECORD(COMBINE(xp_iid_record_, __COUNTER__), intf)
+
+namespace detail {
+
+#if defined(__linux__)
+// The records of the manifest section of an ELF image, false if it is not a valid ELF image.
+template <typename Ehdr, typename Shdr>
+bool read_iid_section(const unsigned char* image, std::size_t size, std::vector<std::string>& names)
+{
+    if (size < sizeof(Ehdr)) return false;
+    Ehdr eh;
+    std::memcpy(&eh, image, sizeof(eh));
+    if (eh.e_shentsize != sizeof(Shdr) || eh.e_shoff > size || eh.e_shnum > (size - eh.e_shoff) / sizeof(Shdr)) return false;
+    if (eh.e_shstrndx >= eh.e_shnum) return false;
+
+    auto section = [&](std::size_t i) {
+        Shdr sh;
+        std::memcpy(&sh, image + eh.e_shoff + i * sizeof(Shdr), sizeof(sh));
+        return sh;
+    };
+    const auto strtab = section(eh.e_shstrndx);
+    if (strtab.sh_offset > size || strtab.sh_size > size - strtab.sh_offset) return false;
+    const auto* strs = reinterpret_cast<const char*>(image + strtab.sh_offset);
+
+    constexpr std::size_t name_size = sizeof(XP_IID_MANIFEST_SECTION);
+    for (std::size_t i = 0; i < eh.e_shnum; i++) {
+        const auto sh = section(i);
+        if (strtab.sh_size < name_size || sh.sh_name > strtab.sh_size - name_size || std::memcmp(strs + sh.sh_name, XP_IID_MANIFEST_SECTION, name_size) != 0) continue;
+        if (sh.sh_type == SHT_NOBITS || sh.sh_offset > size || sh.sh_size > size - sh.sh_offset) return false;
+
+        // records of several objects, maybe padded in between
+        const auto* p = image + sh.sh_offset;
+        const auto* end = p + sh.sh_size;
+        while (end - p >= static_cast<std::ptrdiff_t>(sizeof(iid_record))) {
+            iid_record r;
+            std::memcpy(&r, p, sizeof(r));
+            if (std::memcmp(r.magic, iid_record::signature, sizeof(r.magic)) != 0) {
+                p += alignof(iid_record);
+                continue;
+            }
+            if (r.name[sizeof(r.name) - 1] == '\0') names.emplace_back(r.name);
+            p += sizeof(iid_record);
+        }
+    }
+    return true;
+}
+#endif
+
+} // namespace detail
+
+/**
+ * @brief Reads the IID manifest of a binary, without loading it.
+ *
+ * @param path path of the binary
+ *
+ * @return the DECLARE_IID() strings of the interfaces listed (empty if none), nothing if the file cannot
+ * be read or is not an ELF binary.
+ */
+inline std::optional<std::vector<std::string>> read_iid_manifest(const std::string& path)
+{
+#if defined(__linux__)
+    const detail::mapped_file file(path);
+    if (file.size() < EI_NIDENT) return std::nullopt;
+
+    const auto* image = file.data();
+    const auto size = file.size();
+    if (std::memcmp(image, ELFMAG, SELFMAG) != 0) return std::nullopt;
+
+    std::vector<std::string> names;
+    bool valid = false;
+    if (image[EI_CLASS] == ELFCLASS64) {
+        valid = detail::read_iid_section<Elf64_Ehdr, Elf64_Shdr>(image, size, names);
+    } else if (image[EI_CLASS] == ELFCLASS32) {
+        valid = detail::read_iid_section<Elf32_Ehdr, Elf32_Shdr>(image, size, names);
+    }
+    if (!valid) return std::nullopt;
+    return names;
+#else
+    (void)path;
+    return std::nullopt;
+#endif
+}
+
+} // namespace xp
+
+#endif
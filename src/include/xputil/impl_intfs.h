@@ -12,15 +12,34 @@
 #define _XP_IMPL_INTFS_H_
 
 #include "class_util.h"
+#include "grace_period.h"
+#include "iid_find.h"
+#include "iid_index.h"
 #include "intf_defs.h"
 #include "on_exit.h"
+#include "perfect_hash.h"
+#include "shared_vector.h"
+#include "small_vector.h"
+#include "worker_pool.h"
 
 #include <algorithm>
+#include <array>
+#include <atomic>
 #include <cassert>
+#include <chrono>
+#include <condition_variable>
 #include <functional>
+#include <future>
+#include <iterator>
 #include <memory>
+#include <optional>
 #include <stdexcept>
+#include <thread>
+#include <typeinfo>
+#include <utility>
 #include <vector>
+#include <map>
+#include <unordered_map>
 #include <unordered_set>
 #include <mutex>
 
@@ -31,22 +50,92 @@
 
 namespace xp {
 
+class TBus;
+
 namespace detail {
 
-struct QueryState : IQueryState {
+// Visited set of a single query.
+//
+// The class is final so that TBus, which traverses its own connections with the concrete type,
+// gets the non-virtual searched()/mark() inlined; the IQueryState overrides are only used by
+// foreign IInterfaceEx implementations. A typical query visits a handful of objects, they are
+// kept in a small inline buffer before spilling into a hash set.
+struct QueryState final : IQueryState {
 public:
     void addSearched(void* p) override
     {
-        _searched.insert(p);
+        mark(p);
     }
     bool isSearched(void* p) const override
     {
-        return _searched.count(p);
+        return searched(p);
+    }
+
+    bool searched(const void* p) const
+    {
+        const auto last = _local.begin() + _used;
+        if (std::find(_local.begin(), last, p) != last) return true;
+        return !_spill.empty() && _spill.count(const_cast<void*>(p)) > 0;
+    }
+    void mark(void* p)
+    {
+        if (_used < _local.size()) {
+            _local[_used++] = p;
+        } else {
+            _spill.insert(p);
+        }
     }
 
+    // bookkeeping of TBus' route cache
+    IInterfaceEx* provider{nullptr};   // the connected interface which finally resolved the query
+    std::shared_ptr<const void> pin{}; // keeps the provider connected
+    int depth{0};                      // number of buses entered so far
+    bool cacheable{true};              // false once a foreign bus has been traversed
+
 private:
-    std::unordered_set<void*> _searched{};
+    std::array<void*, 16> _local{};
+    std::size_t _used{0};
+    std::unordered_set<void*> _spill{};
 };
+
+// The IQueryState actually passed in is ours (not provided by a foreign implementation)
+inline QueryState* as_query_state(IQueryState& qst)
+{
+    return typeid(qst) == typeid(QueryState) ? static_cast<QueryState*>(&qst) : nullptr;
+}
+
+// resolve() without the virtual IQueryState calls
+template <typename Q>
+inline xp_error_code resolve(IInterfaceEx* pex, TIntfId iid, IInterface** retIntf, Q& qst)
+{
+    if constexpr (std::is_same_v<Q, QueryState>) {
+        if (qst.searched(pex)) return xp_error_code::INTF_NOT_RESOLVED;
+    } else {
+        if (qst.isSearched(pex)) return xp_error_code::INTF_NOT_RESOLVED;
+    }
+    return pex->queryInterfaceEx(iid, retIntf, qst);
+}
+
+// The bus recording the dependencies of its interfaces, nullptr if bus does not. Defined with TBus.
+inline TBus* dependency_recorder(IBus* bus);
+// Notes that the interface connected to bus, self (its most derived object), resolved provider. Defined with TBus.
+inline void note_dependency(TBus* bus, const void* self, IInterfaceEx* provider);
+
+// Resolves an iid a connected interface does not provide itself from its hosting bus, noting what it depends on.
+template <typename Self>
+xp_error_code search_bus(IBus* bus, Self* self, TIntfId iid, IInterface** retIntf, IQueryState& qst)
+{
+    if (!bus) return xp_error_code::INTF_NOT_RESOLVED;
+
+    auto p = as_query_state(qst);
+    const auto before = p ? p->provider : nullptr;
+    const auto ec = xp::resolve(bus, iid, retIntf, qst);
+    if (ec == xp_error_code::OK && p && p->provider && p->provider != before) {
+        // the most derived object only when recorded
+        if (auto recorder = dependency_recorder(bus); recorder) note_dependency(recorder, dynamic_cast<const void*>(self), p->provider);
+    }
+    return ec;
+}
 } // namespace detail
 
 
@@ -251,6 +340,28 @@ constexpr auto make_intf(TArgs&&... args)
 }
 
 
+namespace detail {
+// The IIDs of TInterfaceEx<T> and TMultiInterfaceEx<T, S...> used as they are, known at compile time: they
+// resolve nothing else by themselves. Not of a subclass, which might.
+class implicit_manifest
+{
+public:
+    virtual bool implicitIids(std::span<const TIntfId>& iids) const = 0;
+
+protected:
+    ~implicit_manifest() = default;
+};
+
+// The IIDs advertised to the hosting bus: by IIntfManifest, or else implicitly.
+inline bool advertised_iids(const IInterfaceEx* intf, std::span<const TIntfId>& iids)
+{
+    if (auto manifest = dynamic_cast<const IIntfManifest*>(intf); manifest) return manifest->providedIids(iids);
+    auto implicit = dynamic_cast<const implicit_manifest*>(intf);
+    return implicit && implicit->implicitIids(iids);
+}
+} // namespace detail
+
+
 /**
  * \class TInterfaceEx<>
  * \brief Implements IInterfaceEx
@@ -291,7 +402,7 @@ constexpr auto make_intf(TArgs&&... args)
  *
  */
 template <class T, bool check_iid = true>
-class TInterfaceEx : public TRefObj<T>
+class TInterfaceEx : public TRefObj<T>, public detail::implicit_manifest
 {
     using parent_t = TRefObj<T>;
 
@@ -332,6 +443,19 @@ public:
         _bus = bus;
     }
 
+    // detail::implicit_manifest
+    bool implicitIids(std::span<const TIntfId>& iids) const override
+    {
+        if constexpr (check_iid) {
+            if (typeid(*this) != typeid(TInterfaceEx)) return false; // subclassed
+            static const std::array<TIntfId, 1> ids{IID(T)};
+            iids = ids;
+            return true;
+        } else {
+            return false; // resolved by subclass
+        }
+    }
+
     void finish() override
     {
         if (!_cleared) {
@@ -348,7 +472,7 @@ protected:
 
     xp_error_code searchBus(TIntfId iid, IInterface** retIntf, IQueryState& qst)
     {
-        return _bus ? resolve(_bus, iid, retIntf, qst) : xp_error_code::INTF_NOT_RESOLVED;
+        return detail::search_bus(_bus, this, iid, retIntf, qst);
     }
 
     constexpr bool finished() const
@@ -361,6 +485,31 @@ private:
     bool _cleared{false}; // any apis should not be called any more
 };
 
+/**
+ * Advertises IID(S)... to the hosting bus (IIntfManifest), which then finds the implementation by IID
+ * without calling its queryInterfaceEx() for the other IIDs being resolved.
+ *
+ * Opt-in, for an implementation resolving nothing else by itself:
+ *
+ * \code
+ *  class Hello : public TInterfaceEx<IHello>, public TIntfManifest<IHello> { ... };
+ * \endcode
+ */
+template <class... S>
+class TIntfManifest : public IIntfManifest
+{
+public:
+    bool providedIids(std::span<const TIntfId>& iids) const override
+    {
+        static const std::array<TIntfId, sizeof...(S)> ids{IID(S)...};
+        iids = ids;
+        return true;
+    }
+
+protected:
+    ~TIntfManifest() = default;
+};
+
 template <typename T, typename... TArgs>
 constexpr auto make_intfx(TArgs&&... args)
 {
@@ -397,6 +546,15 @@ public:
 
     using parent_t::queryInterface;
 
+    // detail::implicit_manifest
+    bool implicitIids(std::span<const TIntfId>& iids) const override
+    {
+        if (typeid(*this) != typeid(TMultiInterfaceEx)) return false; // subclassed
+        static const std::array<TIntfId, sizeof...(S)> ids{IID(S)...};
+        iids = ids;
+        return true;
+    }
+
     xp_error_code queryInterfaceEx(TIntfId iid, IInterface** retIntf, IQueryState& qst) override
     {
         if (match_iid<S...>(iid, retIntf)) {
@@ -609,7 +767,7 @@ public:
 
         qst.addSearched(this);
 
-        return _bus ? resolve(_bus, iid, retIntf, qst) : xp_error_code::INTF_NOT_RESOLVED;
+        return detail::search_bus(_bus, this, iid, retIntf, qst);
     }
 
     void setBus(IBus* bus) override
@@ -663,120 +821,436 @@ private:
 };
 
 
-// IBus
-class TBus : public TInterfaceEx<IBus, false>
+/**
+ * \class TLazyInterfaceEx
+ * \brief Connected to a bus in place of a service, which is only created when first resolved
+ *
+ * It advertises the IIDs of the service, and resolves them from the service built by the factory
+ * on the first query of any of them. Concurrent first queries build one instance, the others wait for it;
+ * the factory runs unlocked, factories resolving each other from two threads do not wait for each other
+ * (the service is not resolved, as when queried by its own factory). A factory returning nullptr is not
+ * called again, the IIDs are no longer resolved by the lazy interface.
+ * The service is hosted by the bus of the factory, and finished in its slot (same order).
+ *
+ * The optional protocols of the service (IStartable, IAsyncFinish, IExitCritical) are forwarded to it once
+ * created: a service not created yet is not created to be started, nor to be finished at exit. In dependency
+ * order (TBus::finish_order::dependencies), the service and the lazy interface are the same dependency.
+ *
+ *  \code
+ *  bus->connect(new TLazyInterfaceEx({IID(IHello)}, [] { return new TInterfaceEx<Impl_Hello>(); }), order);
+ *  \endcode
+ */
+class TLazyInterfaceEx : public TRefObj<IInterfaceEx>, public IIntfManifest, public IStartable, public IAsyncFinish, public IExitCritical
 {
 public:
-    explicit TBus(int busLevel = 0) : _level(busLevel) {}
-    TBus(const TBus&) = delete;
-    TBus& operator=(const TBus&) = delete;
-    TBus(TBus&&) = delete;
-    TBus& operator=(TBus&&) = delete;
+    // returns the service created (unreferenced), nullptr if it cannot be created
+    using factory_t = std::function<IInterfaceEx*()>;
 
-    auto total_intfs() const
+    TLazyInterfaceEx(std::vector<TIntfId> iids, factory_t factory) : _iids(std::move(iids)), _factory(std::move(factory)) {}
+
+    TLazyInterfaceEx(const TLazyInterfaceEx&) = delete;
+    TLazyInterfaceEx(TLazyInterfaceEx&&) = delete;
+    TLazyInterfaceEx& operator=(const TLazyInterfaceEx&) = delete;
+    TLazyInterfaceEx& operator=(TLazyInterfaceEx&&) = delete;
+
+    // IInterface
+    xp_error_code queryInterface(TIntfId iid, IInterface** retIntf) override
     {
-        std::lock_guard lock(_mutex);
-        return _intfs.size();
+        detail::QueryState qst;
+        return queryInterfaceEx(iid, retIntf, qst);
     }
-    auto total_buses() const
+    // IInterfaceEx
+    xp_error_code queryInterfaceEx(TIntfId iid, IInterface** retIntf, IQueryState& qst) override
     {
-        std::lock_guard lock(_mutex);
-        return _buses.size();
+        qst.addSearched(this);
+
+        auto p = _instance.load(std::memory_order_acquire);
+        if (!p && std::find(_iids.begin(), _iids.end(), iid) != _iids.end()) p = instance();
+        if (p) return resolve(p, iid, retIntf, qst);
+
+        auto bus = _bus.load();
+        return bus ? resolve(bus, iid, retIntf, qst) : xp_error_code::INTF_NOT_RESOLVED;
     }
-    auto total_siblings() const
+    void setBus(IBus* bus) override
     {
-        std::lock_guard lock(_mutex);
-        return _siblings.size();
+        if (_bus.load() != nullptr && bus != nullptr)
+            throw std::logic_error("TLazyInterfaceEx::setBus() >> hosting bus already exists!");
+        _bus.store(bus);
+        if (auto p = _instance.load(); p) p->setBus(bus);
+    }
+    void finish() override
+    {
+        std::unique_lock lock(_mutex);
+        _built.wait(lock, [this] { return !_building; });
+        if (_finished) return;
+
+        if (auto p = _instance.load(); p) p->finish();
+        _bus.store(nullptr);
+        _finished = true;
     }
 
-    // IBus
-    [[nodiscard]] bool connect(gsl::not_null<IInterfaceEx*> intf, int order = 0) override
+    // IIntfManifest
+    bool providedIids(std::span<const TIntfId>& iids) const override
     {
-        Expects(!this->finished());
+        iids = _iids;
+        return true;
+    }
 
-        if (intf == this) return false; // no loop-back.
+    // IStartable
+    std::span<const TIntfId> startDependencies() const override
+    {
+        auto p = dynamic_cast<const IStartable*>(created());
+        return p ? p->startDependencies() : std::span<const TIntfId>{};
+    }
+    void start() override
+    {
+        if (auto p = dynamic_cast<IStartable*>(created()); p) p->start();
+    }
 
-        std::lock_guard lock(_mutex);
+    // IAsyncFinish
+    std::future<void> finishAsync() override
+    {
+        std::unique_lock lock(_mutex);
+        _built.wait(lock, [this] { return !_building; });
+        if (_finished) return {};
+
+        std::future<void> done;
+        if (auto p = _instance.load(); p) {
+            if (auto async = dynamic_cast<IAsyncFinish*>(p); async) {
+                done = async->finishAsync();
+            } else {
+                p->finish();
+            }
+        }
+        _bus.store(nullptr);
+        _finished = true;
+        return done;
+    }
 
-        IBus* bus{nullptr};
-        detail::QueryState qst;
-        if (intf->queryInterfaceEx(IID_IBUS, (IInterface**)&bus, qst) == xp_error_code::OK) { // NOLINT
-            ON_EXIT(bus->unref());                                                            // balance queryInterface
+    // IExitCritical
+    bool finishAtExit() const override
+    {
+        auto p = dynamic_cast<const IExitCritical*>(created());
+        return p && p->finishAtExit();
+    }
 
-            const int level = bus->level();
-            if (level > _level) {
-                // do not allow duplicated buses
-                if (auto it = std::find(_buses.begin(), _buses.end(), bus); it != _buses.end())
-                    return false;
+    // the service created, nullptr if not yet
+    IInterfaceEx* created() const
+    {
+        return _instance.load(std::memory_order_acquire);
+    }
 
-                // strong reference only for different level.
-                bus->ref();
-                _buses.push_back(bus);
+protected:
+    ~TLazyInterfaceEx() override
+    {
+        if (auto p = _instance.load(); p) p->unref();
+    }
+
+private:
+    const std::vector<TIntfId> _iids;
+    const factory_t _factory;
+
+    std::atomic<IBus*> _bus{nullptr};
+    std::atomic<IInterfaceEx*> _instance{nullptr}; // referenced
+    std::mutex _mutex;
+    std::condition_variable _built;          // notified once the service is built
+    std::atomic<std::thread::id> _builder{}; // thread building the service
+    bool _building{false};                   // GUARDED_BY(_mutex)
+    bool _failed{false};                     // GUARDED_BY(_mutex), the factory returned nullptr
+    bool _finished{false};                   // GUARDED_BY(_mutex)
+
+    // The lazy interfaces waited for, by thread.
+    static std::mutex& waits_mutex()
+    {
+        static std::mutex m;
+        return m;
+    }
+    static std::unordered_map<std::thread::id, const TLazyInterfaceEx*>& waits() // GUARDED_BY(waits_mutex())
+    {
+        static std::unordered_map<std::thread::id, const TLazyInterfaceEx*> w;
+        return w;
+    }
 
-                std::sort(_buses.begin(), _buses.end(), [](auto x, auto y) { return x->level() < y->level(); });
-                return true;
+    // Waits for the service being built by another thread, false if that builder waits (transitively) for this thread.
+    bool await_build(std::unique_lock<std::mutex>& lock)
+    {
+        const auto self = std::this_thread::get_id();
+        {
+            std::lock_guard graph(waits_mutex());
+            for (const TLazyInterfaceEx* p = this; p != nullptr;) {
+                const auto builder = p->_builder.load();
+                if (builder == self) return false;
+                auto it = waits().find(builder);
+                p = it != waits().end() ? it->second : nullptr;
             }
+            waits()[self] = this;
+        }
+        _built.wait(lock, [this] { return !_building; });
 
-            if (level == _level) {
-                if (bus->count() == 1) {
-                    // sibing bus is not referenced outside.
-                    //
-                    // Because we only keep a weak reference to a sibling bus, which will be destroyed if there is no external
-                    // reference lock.
-                    // ex:  bus0->connect(new TBus(0));
-                    //
-                    // we could unrefNoDelete it to keep it alive after return, but it might lead to memory leakge if it is not
-                    // referenced later.
-                    // so we can avoid this kind of usage before bad things happens.
-                    return false;
-                }
+        std::lock_guard graph(waits_mutex());
+        waits().erase(self);
+        return true;
+    }
 
-                // no loop-back
-                if (bus == this)
-                    return false;
+    // The service, built by the first caller.
+    IInterfaceEx* instance()
+    {
+        if (_builder.load() == std::this_thread::get_id()) return nullptr; // queried by its own factory
 
-                // do not allow duplicated buses
-                if (auto it = std::find(_siblings.begin(), _siblings.end(), bus); it != _siblings.end())
-                    return false;
+        {
+            std::unique_lock lock(_mutex);
+            if (_building && !await_build(lock)) return nullptr;
+            if (auto p = _instance.load(); p || _failed || _finished) return p;
+
+            _building = true;
+            _builder.store(std::this_thread::get_id());
+        }
+
+        IInterfaceEx* p{nullptr};
+        try {
+            p = _factory();
+        } catch (...) {
+            built(nullptr, false); // called again
+            throw;
+        }
+        built(p, p == nullptr);
+        return p;
+    }
+
+    // Publishes the service built, and wakes up the threads waiting for it.
+    void built(IInterfaceEx* p, bool failed)
+    {
+        std::lock_guard lock(_mutex);
+        if (p) {
+            p->ref();
+            auto bus = _bus.load();
+            if (bus) p->setBus(bus);
+            _instance.store(p, std::memory_order_release);
+            if (bus && _bus.load() != bus) p->setBus(nullptr); // disconnected meanwhile
+        }
+        _failed = failed;
+        _builder.store(std::thread::id{});
+        _building = false;
+        _built.notify_all();
+    }
+};
+
+
+/**
+ * \class TEnumeratorEx<>
+ * \brief Implements IEnumeratorEx over a shared, immutable list of values
+ *
+ * Enumerators of the same list (ex: a cached query result) share it, each one with its own position.
+ */
+template <typename T>
+class TEnumeratorEx : public TRefObj<IEnumeratorEx<T>>
+{
+public:
+    explicit TEnumeratorEx(std::shared_ptr<const std::vector<T>> values) : _values(std::move(values)) {}
+
+    bool hasNext() override
+    {
+        return _pos < _values->size();
+    }
+    gsl::not_null<T> next() override
+    {
+        Expects(hasNext());
+        return (*_values)[_pos++];
+    }
+    std::size_t size() const override
+    {
+        return _values->size();
+    }
+    gsl::not_null<T> get(unsigned int index) const override
+    {
+        Expects(index < _values->size());
+        return (*_values)[index];
+    }
+    void rewind() override
+    {
+        _pos = 0;
+    }
+
+private:
+    std::shared_ptr<const std::vector<T>> _values;
+    std::size_t _pos{0};
+};
 
-                // weak reference only for sibling bus to avoid reference deadlock, remove when being destroyed.
-                _siblings.insert(bus);
-                // sibling bus, mutual connection
-                bus->addSiblingBus(this);
 
-                return true;
+namespace detail {
+// Keeps the interfaces left draining by the buses destroyed (stragglers) alive until drained, on a thread of its
+// own while some are draining, joined at exit: the drains still pending then are awaited up to their finish
+// timeout, from the exit, the interfaces left draining after that are deliberately leaked (not released, as by
+// TBus::fastExit()).
+class drain_reaper
+{
+public:
+    using clock = std::chrono::steady_clock;
+
+    // nullptr at exit, once destroyed
+    static drain_reaper* instance()
+    {
+        static drain_reaper reaper;
+        return _exited.load() ? nullptr : &reaper;
+    }
+
+    void add(auto_ref<IInterfaceEx> intf, std::future<void> done, std::chrono::milliseconds timeout)
+    {
+        {
+            std::lock_guard lock(_mutex);
+            if (_exiting) {
+                leak(intf, done);
+                return;
             }
+            _draining.push_back({std::move(intf), std::move(done), timeout});
+            if (!_running) {
+                if (_thread.joinable()) _thread.join(); // idle, done
+                _thread = std::thread([this] { run(); });
+                _running = true;
+            }
+        }
+        _changed.notify_one();
+    }
 
-            // bus level smaller than mine, connection failure.
-            return false;
+    // Leaks an interface left draining, and its drain (the future of std::async() would wait for it).
+    static void leak(auto_ref<IInterfaceEx>& intf, std::future<void>& done)
+    {
+        if (intf) intf->ref();
+        static_cast<void>(new std::future<void>(std::move(done)));
+    }
+
+    drain_reaper(const drain_reaper&) = delete;
+    drain_reaper& operator=(const drain_reaper&) = delete;
+
+    ~drain_reaper()
+    {
+        std::thread worker; // the ones added from now on are leaked
+        {
+            std::lock_guard lock(_mutex);
+            _exiting = clock::now();
+            worker = std::move(_thread);
         }
+        _changed.notify_one();
+        if (worker.joinable()) worker.join();
+        _exited.store(true);
+    }
 
-        // no duplicated interfaces
-        if (auto it = std::find_if(_intfs.begin(), _intfs.end(), [intf](const auto& x) { return x.second == intf; }); it != _intfs.end())
-            return false;
+private:
+    struct entry {
+        auto_ref<IInterfaceEx> intf;
+        std::future<void> done;
+        std::chrono::milliseconds timeout;
+    };
+    static constexpr auto poll_interval = std::chrono::milliseconds(10);
+    static inline std::atomic<bool> _exited{false};
+
+    std::mutex _mutex;
+    std::condition_variable _changed;           // an interface added, or the exit
+    std::vector<entry> _draining{};             // GUARDED_BY(_mutex)
+    std::optional<clock::time_point> _exiting{}; // GUARDED_BY(_mutex)
+    bool _running{false};                       // GUARDED_BY(_mutex), run() until none is draining
+    std::thread _thread{};                      // GUARDED_BY(_mutex)
+
+    drain_reaper() = default;
+
+    // Polls the drains: a drain completes without notifying.
+    void run()
+    {
+        std::unique_lock lock(_mutex);
+        while (!_draining.empty()) {
+            std::vector<entry> drained; // released unlocked
+            for (auto it = _draining.begin(); it != _draining.end();) {
+                if (it->done.wait_for(std::chrono::seconds(0)) == std::future_status::ready) {
+                    drained.push_back(std::move(*it));
+                    it = _draining.erase(it);
+                } else if (_exiting && clock::now() >= *_exiting + it->timeout) {
+                    leak(it->intf, it->done);
+                    it = _draining.erase(it);
+                } else {
+                    ++it;
+                }
+            }
+            if (!drained.empty()) {
+                lock.unlock();
+                drained.clear();
+                lock.lock();
+            } else if (!_draining.empty()) {
+                _changed.wait_for(lock, poll_interval);
+            }
+        }
+        _running = false;
+    }
+};
+} // namespace detail
 
-        intf->ref();
-        _intfs.emplace_back(order, intf);
-        intf->setBus(this);
-        return true;
+// IBus
+class TBus : public TInterfaceEx<IBusEx, false>
+{
+public:
+    explicit TBus(int busLevel = 0) : _level(busLevel) {}
+    TBus(const TBus&) = delete;
+    TBus& operator=(const TBus&) = delete;
+    TBus(TBus&&) = delete;
+    TBus& operator=(TBus&&) = delete;
+
+    auto total_intfs() const
+    {
+        return links()->size();
+    }
+    auto total_buses() const
+    {
+        return links()->buses.size();
+    }
+    auto total_siblings() const
+    {
+        return links()->siblings.size();
     }
 
-    void disconnect(gsl::not_null<IInterfaceEx*> intf) override
+    // IBus
+    // Lookups never lock because each connection publishes a new version of my connection lists, sharing
+    // them with the previous one: connecting a service takes a constant time, unless of a higher priority
+    // than the last one connected (connectRanked()), which copies the ranking of the IIDs.
+    [[nodiscard]] bool connect(gsl::not_null<IInterfaceEx*> intf, int order = 0) override
     {
-        std::lock_guard lock(_mutex);
-        Expects(!this->finished());
+        return connectRanked(intf, 0, order);
+    }
 
-        // interfaces first
-        if (auto it = std::find_if(_intfs.begin(), _intfs.end(), [intf](const auto& x) { return x.second == intf; }); it != _intfs.end()) {
-            _intfs.erase(it);
-            intf->setBus(nullptr);
-            intf->unref();
-            return;
+    void disconnect(gsl::not_null<IInterfaceEx*> intf) override
+    {
+        std::shared_ptr<const Links> retired;
+        TBus* unparented{nullptr};
+        {
+            std::lock_guard lock(_mutex);
+            Expects(!this->finished());
+            if (frozen()) throw std::logic_error("TBus::disconnect() >> bus is frozen!");
+
+            const auto cur = links();
+            // interfaces first
+            if (const auto pos = _positions.find(*cur, intf); pos < cur->intfs.size()) {
+                intf->setBus(nullptr);
+                retired = update([pos](Links& l) { l.remove(pos); }, {intf});
+                if (const auto l = links(); l->intfs.size() < cur->intfs.size()) {
+                    _positions.rebuild(*l); // compacted
+                } else {
+                    _positions.erase(*l, pos);
+                }
+                forget(dynamic_cast<const void*>(intf.get()));
+                if (auto created = created_by(intf); created) forget(created);
+            }
+            // buses later
+            else if (auto it = std::find(cur->buses.begin(), cur->buses.end(), intf); it != cur->buses.end()) {
+                IBus* bus = *it;
+                if (auto p = native(bus); p) {
+                    p->removeParent(this);
+                    unparented = p;
+                }
+                retired = update([bus](Links& l) { l.buses.erase(std::find(l.buses.begin(), l.buses.end(), bus)); }, {bus});
+            }
         }
-        // buses later
-        if (auto it = find(_buses.begin(), _buses.end(), intf); it != _buses.end()) {
-            _buses.erase(it);
-            intf->unref();
+        if (unparented) unparented->awaitParentRemoval(this); // still referenced by retired
+        if (retired) {
+            // the released object goes away once no reader, route or cached query can reach it any more
+            touch();
             return;
         }
 
@@ -799,126 +1273,1883 @@ public:
         if (_level == busLevel)
             return this;
 
-        std::lock_guard lock(_mutex);
-        for (auto bus : _buses) {
-            if (auto p = bus->findFirstBusByLevel(busLevel); p) return p;
-        }
-
-        for (auto bus : _siblings) {
-            if (auto p = bus->findFirstBusByLevel(busLevel); p) return p;
+        if (const auto indexed = levels(); indexed->complete) {
+            const auto found = indexed->find(busLevel);
+            return found ? found->front() : nullptr;
         }
 
-        return nullptr;
+        // a foreign bus is reachable, it might have changed since
+        detail::QueryState visited;
+        return walkLevel(busLevel, visited);
     }
 
 
     void addSiblingBus(gsl::not_null<IBus*> bus) override
     {
-        std::lock_guard lock(_mutex);
-        Expects(!this->finished());
+        {
+            std::lock_guard lock(_mutex);
+            Expects(!this->finished());
+            if (frozen()) throw std::logic_error("TBus::addSiblingBus() >> bus is frozen!");
 
-        _siblings.insert(bus);
+            if (const auto cur = links(); std::find(cur->siblings.begin(), cur->siblings.end(), bus) == cur->siblings.end()) {
+                update([bus](Links& l) { l.siblings.push_back(bus); });
+            }
+        }
+        const auto added = summary(bus);
+        touch(&added);
     }
 
     void removeSiblingBus(gsl::not_null<IBus*> bus) override
     {
-        std::lock_guard lock(_mutex);
-        Expects(!this->finished());
+        {
+            std::lock_guard lock(_mutex); // finished or abandoned: no sibling left
 
-        _siblings.erase(bus);
+            update([bus](Links& l) {
+                if (auto it = std::find(l.siblings.begin(), l.siblings.end(), bus); it != l.siblings.end()) l.siblings.erase(it);
+            });
+        }
+        touch();
+        // weak-referenced: the sibling might be going away, wait for the readers still walking through it.
+        // From within a lookup of mine, that may be walking through it too, it is kept alive until the lookup is over.
+        if (!awaitReaders()) keepAlive(bus);
     }
 
     xp_error_code queryInterfaceEx(TIntfId iid, IInterface** retIntf, IQueryState& qst) override
+    {
+        if (auto p = detail::as_query_state(qst); p) return query(iid, retIntf, *p);
+        return query(iid, retIntf, qst);
+    }
+
+    // IBusEx
+    std::size_t queryInterfaces(std::span<const TIntfId> iids, std::span<IInterface*> retIntfs) override
+    {
+        Expects(!this->finished());
+        Expects(retIntfs.size() >= iids.size());
+
+        // definite misses are not searched
+        const auto f = reach();
+        std::size_t pending = 0;
+        for (std::size_t i = 0; i < iids.size(); i++) {
+            retIntfs[i] = nullptr;
+            if (self(iids[i])) {
+                this->ref();
+                retIntfs[i] = this;
+            } else if (!f || f->may_contain(iids[i])) {
+                pending++;
+            }
+        }
+        std::vector<bool> searched(iids.size(), false); // by a lookup
+        if (pending > 0) lookupMany(iids, retIntfs, searched, pending);
+        if (pending > 0) {
+            detail::QueryState visited;
+            walkMany(iids, retIntfs, searched, pending, visited);
+        }
+
+        return static_cast<std::size_t>(std::count_if(retIntfs.begin(), retIntfs.begin() + iids.size(), [](auto p) { return p != nullptr; }));
+    }
+
+    IEnumeratorEx<IInterface*>* queryAll(TIntfId iid) override
+    {
+        Expects(!this->finished());
+
+        auto all = new TEnumeratorEx<IInterface*>(providers(iid));
+        all->ref();
+        return all;
+    }
+
+    IEnumeratorEx<IBus*>* findBusesByLevel(int busLevel) override
+    {
+        Expects(!this->finished());
+
+        const auto indexed = levels();
+        const auto found = indexed->find(busLevel);
+        auto all = new TEnumeratorEx<IBus*>(found ? std::shared_ptr<const std::vector<IBus*>>(indexed, found) : std::make_shared<const std::vector<IBus*>>());
+        all->ref();
+        return all;
+    }
+
+    // The interfaces are validated and deduplicated by hashing, and published with one update, instead of one
+    // version of the connection lists per interface. Buses are connected one by one.
+    std::size_t connectMany(std::span<IInterfaceEx* const> intfs, int order = 0) override
+    {
+        Expects(!this->finished());
+
+        std::size_t connected = 0;
+        std::vector<IInterfaceEx*> buses;
+        detail::iid_filter added;
+        {
+            std::lock_guard lock(_mutex);
+            if (frozen()) return 0;
+
+            const auto cur = links();
+            std::unordered_set<IInterfaceEx*> seen;
+            seen.reserve(intfs.size());
+
+            std::vector<IInterfaceEx*> accepted;
+            accepted.reserve(intfs.size());
+            for (auto intf : intfs) {
+                if (!intf || intf == this || _positions.find(*cur, intf) < cur->intfs.size() || !seen.insert(intf).second) continue;
+                if (is_bus(intf)) {
+                    buses.push_back(intf);
+                } else {
+                    accepted.push_back(intf);
+                }
+            }
+
+            if (!accepted.empty()) {
+                for (auto intf : accepted) intf->ref();
+                update([&](Links& l) {
+                    l.intfs.reserve(l.intfs.size() + accepted.size());
+                    l.priorities.reserve(l.priorities.size() + accepted.size());
+                    for (auto intf : accepted) l.add(intf, order, 0, &added);
+                });
+                const auto l = links();
+                for (auto pos = cur->intfs.size(); pos < l->intfs.size(); pos++) _positions.insert(*l, pos);
+                for (auto intf : accepted) intf->setBus(this);
+                connected = accepted.size();
+            }
+        }
+        if (connected > 0) touch(&added);
+
+        for (auto bus : buses) {
+            if (connect(bus, order)) connected++;
+        }
+        return connected;
+    }
+
+    [[nodiscard]] bool connectRanked(gsl::not_null<IInterfaceEx*> intf, int priority, int order = 0) override
+    {
+        Expects(!this->finished());
+
+        if (intf == this) return false; // no loop-back.
+
+        detail::iid_filter added;
+        IBus* bus{nullptr};
+        const auto linked = link(intf, order, priority, added, bus);
+        if (linked == link_t::NONE) return false;
+
+        // sibling bus, mutual connection
+        if (linked == link_t::SIBLING) bus->addSiblingBus(this);
+        if (bus) added = summary(bus);
+        touch(&added);
+        return true;
+    }
+
+    void addDependency(gsl::not_null<IInterfaceEx*> dependent, gsl::not_null<IInterfaceEx*> provider) override
+    {
+        Expects(!this->finished());
+        depend(dynamic_cast<const void*>(dependent.get()), dynamic_cast<const void*>(provider.get()));
+    }
+
+    // Visits my connections as of now: f(interfaces with their order, their priorities, upper-level buses, sibling buses).
+    template <typename F>
+    void inspect(F&& f) const
+    {
+        detail::grace_period::reader reading(_readers);
+        const auto l = links();
+        std::vector<std::pair<int, IInterfaceEx*>> intfs;
+        std::vector<int> priorities;
+        for (std::size_t pos = 0; pos < l->intfs.size(); pos++) {
+            if (l->gap(pos)) continue;
+            intfs.push_back(l->intfs[pos]);
+            priorities.push_back(l->priorities[pos]);
+        }
+        f(std::as_const(intfs), std::as_const(priorities), std::as_const(l->buses), std::as_const(l->siblings));
+    }
+
+    // Connects the interfaces and buses of a topology known to be valid (see topology.h) to this empty bus,
+    // published at once: none of them is probed, nor checked for duplicates.
+    //
+    // priorities: of the interfaces (connectRanked()), 0 if missing; buses: upper-level buses; siblings: buses of
+    // the same level, which must restore me as well.
+    void restore(const std::vector<std::pair<int, IInterfaceEx*>>& intfs, const std::vector<int>& priorities, const std::vector<IBus*>& buses,
+                 const std::vector<IBus*>& siblings)
+    {
+        {
+            std::lock_guard lock(_mutex);
+            Expects(!this->finished());
+            Expects(!frozen());
+            const auto cur = links();
+            Expects(cur->size() == 0 && cur->buses.empty() && cur->siblings.empty());
+
+            for (auto [_, intf] : intfs) intf->ref();
+            for (auto bus : buses) {
+                Expects(bus->level() > _level);
+                bus->ref();
+            }
+            update([&](Links& l) {
+                l.intfs.assign(intfs.begin(), intfs.end());
+                l.priorities.assign(priorities.begin(), priorities.end());
+                l.reindex();
+                l.buses.assign(buses.begin(), buses.end());
+                std::stable_sort(l.buses.begin(), l.buses.end(), [](auto x, auto y) { return x->level() < y->level(); });
+                l.siblings.assign(siblings.begin(), siblings.end());
+            });
+            _positions.rebuild(*links());
+            for (auto [_, intf] : intfs) intf->setBus(this);
+        }
+        for (auto bus : buses) {
+            if (auto p = native(bus); p) p->addParent(this);
+        }
+        touch();
+    }
+
+    // Freezes this bus and every native bus reachable from it, for the lookups after the startup:
+    // connect() fails and disconnect() throws until thaw(). The reachable services are resolved from a
+    // perfect hash table, without locking.
+    //
+    // The buses frozen along are kept alive until thaw(). finish() is still allowed, it thaws the bus.
+    void freeze()
+    {
+        std::lock_guard lock(_mutex);
+        Expects(!this->finished());
+        if (_freeze) return;
+
+        auto state = std::make_unique<Frozen>();
+        detail::QueryState visited;
+        visited.mark(this);
+        _freezes++;
+        freezeLinks(state->buses, visited);
+
+        // unless the graph cannot be compiled (the lookups walk it then)
+        Routes r;
+        detail::QueryState reached;
+        if (compile(r, reached)) {
+            state->routes = detail::perfect_hash_map<IInterfaceEx*>({r.providers.begin(), r.providers.end()});
+            state->pinned = std::move(r.pinned);
+            _frozen.store(state.get(), std::memory_order_release);
+        }
+        _freeze = std::move(state);
+    }
+
+    // Re-enables the mutation of the buses frozen by freeze(), unless frozen by another bus too.
+    void thaw()
+    {
+        std::unique_ptr<Frozen> state;
+        {
+            std::lock_guard lock(_mutex);
+            if (!_freeze) return;
+
+            state = std::move(_freeze);
+            _frozen.store(nullptr);
+            _freezes--;
+        }
+        for (auto p : state->buses) {
+            p->_freezes--;
+            p->unref();
+        }
+        state->buses.clear();
+
+        // not freed under the feet of a lookup
+        if (!awaitReaders()) {
+            std::lock_guard lock(_mutex);
+            _graveyard.push_back(std::move(state));
+        }
+    }
+
+    bool frozen() const
+    {
+        return _freezes.load() > 0;
+    }
+
+    // Finishes my interfaces of the same order concurrently, on up to workers threads started for the shutdown:
+    // a pass completes before the next one starts, and the last one before my upper-level buses are finished.
+    // 0 or 1 (the default): one by one, the last connected first.
+    void setFinishWorkers(std::size_t workers)
+    {
+        _finish_workers.store(workers);
+    }
+    std::size_t finishWorkers() const
+    {
+        return _finish_workers.load();
+    }
+
+    // The drains of the interfaces finished together (IAsyncFinish) are awaited up to timeout since they were
+    // finished: since their pass started, or since the finish started in dependency order. The interfaces still
+    // draining then are left to their drain, and listed by stragglers(). 0 (the default): no limit.
+    void setFinishTimeout(std::chrono::milliseconds timeout)
+    {
+        _finish_timeout.store(timeout);
+    }
+    std::chrono::milliseconds finishTimeout() const
+    {
+        return _finish_timeout.load();
+    }
+
+    struct straggler {
+        auto_ref<IInterfaceEx> intf; // kept alive until drained
+        std::future<void> done;      // completed once drained
+    };
+    // Takes the interfaces whose drain timed out so far. Those not taken are left to their drain by the destruction
+    // of the bus, which does not wait for them: they are released once drained. At exit, they are awaited up to
+    // the finish timeout, then leaked.
+    std::vector<straggler> stragglers()
+    {
+        std::lock_guard lock(_deps_mutex);
+        return std::exchange(_stragglers, {});
+    }
+
+    // How finish() orders my interfaces.
+    enum class finish_order {
+        passes,      // by ascending connect() order, the last connected first within an order (the default)
+        dependencies // a dependent before its providers, the order is ignored
+    };
+
+    // In dependency order, an interface resolving another one connected to this bus (searchBus()) depends on
+    // it, so does one declared by addDependency(): set it before the interfaces resolve each other. A dependency
+    // cycle is broken by finishing the interfaces left in it last, the last connected first.
+    //
+    // The interfaces whose dependents are all finished are finished concurrently on the finish workers, if any.
+    void setFinishOrder(finish_order order)
+    {
+        _finish_order.store(order);
+    }
+    finish_order finishOrder() const
+    {
+        return _finish_order.load();
+    }
+
+    // Starts the IStartable interfaces connected to this bus and to its upper-level buses (recursively, those
+    // first), unless started already. An interface is started once the ones connected here resolving its
+    // startDependencies() are, the first connected first among the ones ready, concurrently on up to workers
+    // threads if more than 1. A dependency cycle is broken by starting the first connected interface left
+    // (the reverse of the finish order of a cycle), then the ones it unblocks, until none is left.
+    //
+    // A start dependency is a finish dependency as well (finish_order::dependencies). The sibling buses are not
+    // started. If a start() throws, the interfaces depending on it are not started and the exception is rethrown.
+    // The service of a lazy interface (TLazyInterfaceEx) is started by the first start() once it is created,
+    // the one created to resolve a start dependency by that start().
+    //
+    // Returns the interfaces started to break a cycle, before some of the ones they need (empty if none).
+    std::vector<IInterfaceEx*> start(std::size_t workers = 0)
+    {
+        Expects(!this->finished());
+        std::lock_guard starting(_start_mutex);
+
+        std::vector<IInterfaceEx*> cycles;
+        const auto l = links();
+        for (auto bus : l->buses) {
+            if (auto p = native(bus); p) {
+                const auto upper = p->start(workers);
+                cycles.insert(cycles.end(), upper.begin(), upper.end());
+            }
+        }
+
+        std::vector<std::pair<IInterfaceEx*, IStartable*>> pending;
+        std::unordered_set<IInterfaceEx*> idle; // lazy interfaces, their service not created yet
+        {
+            std::lock_guard lock(_deps_mutex);
+            for (auto [_, intf] : l->connected()) {
+                if (dynamic_cast<const TLazyInterfaceEx*>(intf) && !created_by(intf)) {
+                    idle.insert(intf); // by a start() once created
+                    continue;
+                }
+                if (auto p = dynamic_cast<IStartable*>(intf); p && !_started.contains(dynamic_cast<const void*>(intf))) pending.emplace_back(intf, p);
+            }
+        }
+        if (pending.empty()) return cycles;
+
+        std::unordered_map<IInterfaceEx*, std::size_t> pos;
+        for (std::size_t i = 0; i < pending.size(); i++) pos.emplace(pending[i].first, i);
+
+        // A lazy interface resolved as a dependency is created meanwhile: its service is started as well.
+        std::vector<std::vector<std::size_t>> dependents;
+        std::vector<std::size_t> providers; // not started yet
+        for (std::size_t i = 0; i < pending.size(); i++) {
+            for (auto iid : pending[i].second->startDependencies()) {
+                IInterface* resolved{nullptr};
+                detail::QueryState qst;
+                if (query(iid, &resolved, qst) != xp_error_code::OK) continue;
+                resolved->unref(); // still connected
+                if (!qst.provider) continue;
+
+                depend(dynamic_cast<const void*>(pending[i].first), dynamic_cast<const void*>(qst.provider));
+                if (auto it = idle.find(qst.provider); it != idle.end() && created_by(qst.provider)) {
+                    idle.erase(it);
+                    pos.emplace(qst.provider, pending.size());
+                    pending.emplace_back(qst.provider, dynamic_cast<IStartable*>(qst.provider));
+                }
+                dependents.resize(pending.size());
+                providers.resize(pending.size(), 0);
+                if (const auto p = pos.find(qst.provider); p != pos.end() && p->second != i) {
+                    if (auto& d = dependents[p->second]; std::find(d.begin(), d.end(), i) == d.end()) {
+                        d.push_back(i);
+                        providers[i]++;
+                    }
+                }
+            }
+        }
+        const auto n = pending.size();
+        dependents.resize(n);
+        providers.resize(n, 0);
+
+        std::optional<detail::worker_pool> pool;
+        if (const auto threads = std::min(workers, n); threads > 1) pool.emplace(threads);
+        auto run = [&](std::size_t i) {
+            pending[i].second->start();
+
+            std::lock_guard lock(_deps_mutex);
+            _started.insert(dynamic_cast<const void*>(pending[i].first));
+        };
+        auto started = detail::run_ordered(dependents, std::move(providers), true, run, pool ? &*pool : nullptr);
+        for (auto first = std::find(started.begin(), started.end(), 0); first != started.end(); first = std::find(first, started.end(), 0)) {
+            // Each interface left waits for another one left: following them from the first one ends in a cycle.
+            std::vector<std::size_t> path;
+            std::vector<std::size_t> visited(n, n); // position in path
+            auto at = static_cast<std::size_t>(first - started.begin());
+            while (visited[at] == n) {
+                visited[at] = path.size();
+                path.push_back(at);
+                for (std::size_t j = 0; j < n; j++) {
+                    if (!started[j] && std::find(dependents[j].begin(), dependents[j].end(), at) != dependents[j].end()) {
+                        at = j;
+                        break;
+                    }
+                }
+            }
+            const auto i = *std::min_element(path.begin() + static_cast<std::ptrdiff_t>(visited[at]), path.end()); // the first connected of it
+            cycles.push_back(pending[i].first);
+
+            // i as if its providers were started, the ones started are not run again
+            std::vector<std::size_t> waiting(n, 0);
+            for (std::size_t k = 0; k < n; k++) {
+                if (started[k]) {
+                    waiting[k] = 1;
+                } else {
+                    for (auto next : dependents[k]) waiting[next]++;
+                }
+            }
+            waiting[i] = 0;
+            const auto unblocked = detail::run_ordered(dependents, std::move(waiting), true, run, pool ? &*pool : nullptr);
+            for (std::size_t k = 0; k < n; k++) started[k] = started[k] || unblocked[k];
+        }
+        return cycles;
+    }
+
+    // At process exit, instead of finish(): finishes only the interfaces with side effects outside of the process
+    // (IExitCritical) connected to this bus and its upper-level buses, recursively, in their finish order.
+    // Nothing else is finished, disconnected nor released, the memory is left to the OS: the buses are finished,
+    // their destruction does nothing.
+    //
+    // Like finish(), it does not reach the sibling buses (not owned): their owners exit them, they are only
+    // unlinked from the buses abandoned, which they might outlive.
+    //
+    // A bus of another implementation is finished as usual.
+    void fastExit()
+    {
+        detail::QueryState visited;
+        abandon(visited);
+    }
+
+protected:
+    ~TBus() override
+    {
+        if (_abandoned) {
+            for (auto& s : _stragglers) s.intf->ref(); // left to the OS as well
+            return;
+        }
+        thaw();
+        if (!this->finished()) reset();
+        // not awaited: each one is kept alive until drained
+        for (auto& s : _stragglers) {
+            if (auto reaper = detail::drain_reaper::instance(); reaper) {
+                reaper->add(std::move(s.intf), std::move(s.done), _finish_timeout.load());
+            } else {
+                detail::drain_reaper::leak(s.intf, s.done); // at exit
+            }
+        }
+    }
+
+private:
+    // Connections of a bus, published atomically: readers never lock, writers (connect, disconnect, finish) are
+    // serialized by _mutex.
+    // Versions of the connection lists, each published once by update(). The lists of a version are shared with the
+    // next one, which appends to them in place: connecting an interface takes a constant time. An interface
+    // disconnected is left in place as a gap, skipped by the lookups, until enough of them are compacted at once.
+    struct Links {
+        // IBus* _bus; //hosting bus with a more secure level ( _bus->level() <= this->level() )
+        detail::shared_vector<std::pair<int, IInterfaceEx*>> intfs{};
+        // a few of each in general, stored in place
+        static constexpr std::size_t typical_fanout = 4;
+        detail::small_vector<IBus*, typical_fanout> buses{};    // connected buses with less secure levels ( >= this->level() ), strong-referenced.
+        detail::small_vector<IBus*, typical_fanout> siblings{}; // bus with the same level as mine. (weak-referenced)
+
+        detail::shared_vector<int> priorities{}; // of intfs, the highest priority provider of an IID resolves it
+
+        // Advertised IIDs by rank (priority, then connection order), as a structure of arrays (IID, intfs position)
+        // for a vectorized scan: the first entry of an IID is its best provider.
+        // Past hash_index_threshold IIDs, the first entry of each IID is also kept in a hash index.
+        static constexpr std::size_t hash_index_threshold = 64;
+        detail::shared_vector<TIntfId> iids{};
+        detail::shared_vector<std::size_t> iid_slots{};
+        detail::iid_index index{};
+        detail::shared_vector<std::size_t> unindexed{}; // positions of the interfaces not advertising their IIDs (ascending)
+        detail::shared_vector<std::size_t> exit_critical{}; // positions of the IExitCritical interfaces (ascending)
+
+        // Positions of the interfaces disconnected since the last compaction (ascending), still in the lists above.
+        // Compacted past 1/gap_ratio of the interfaces (min_gaps at least): a disconnection takes a constant time
+        // on average, besides copying the gaps.
+        static constexpr std::size_t gap_ratio = 16;
+        static constexpr std::size_t min_gaps = 64;
+        std::vector<std::size_t> gaps{};
+
+        detail::iid_filter own_filter{}; // summary of the IIDs of my interfaces, and of the gaps
+
+        // Reclamation of a retired version: the objects disconnected from it are released when it is
+        // destroyed, which is after every older version (each one keeps the next one alive).
+        mutable std::vector<IInterfaceEx*> released{};
+        mutable std::shared_ptr<const Links> next{};
+
+        Links() = default;
+        Links(const Links& other)
+            : intfs(other.intfs), buses(other.buses), siblings(other.siblings), priorities(other.priorities), iids(other.iids),
+              iid_slots(other.iid_slots), index(other.index), unindexed(other.unindexed), exit_critical(other.exit_critical),
+              gaps(other.gaps), own_filter(other.own_filter)
+        {
+        }
+        Links& operator=(const Links&) = delete;
+        ~Links()
+        {
+            for (auto p : released) p->unref();
+        }
+
+        std::size_t size() const
+        {
+            return intfs.size() - gaps.size();
+        }
+        bool gap(std::size_t pos) const
+        {
+            return !gaps.empty() && std::binary_search(gaps.begin(), gaps.end(), pos);
+        }
+        // the connected interfaces
+        std::vector<std::pair<int, IInterfaceEx*>> connected() const
+        {
+            std::vector<std::pair<int, IInterfaceEx*>> r;
+            r.reserve(size());
+            for (std::size_t pos = 0; pos < intfs.size(); pos++) {
+                if (!gap(pos)) r.push_back(intfs[pos]);
+            }
+            return r;
+        }
+        // whether all of the connected interfaces advertise their IIDs
+        bool advertised() const
+        {
+            return std::all_of(unindexed.begin(), unindexed.end(), [this](auto pos) { return gap(pos); });
+        }
+
+        // Connects an interface, indexed by its advertised IIDs, also added to the filter if any.
+        void add(IInterfaceEx* intf, int order, int priority, detail::iid_filter* added = nullptr)
+        {
+            intfs.emplace_back(order, intf);
+            priorities.push_back(priority);
+            add_index(intfs.size() - 1, added);
+        }
+        // Indexes the interface at intfs[pos], after the providers of a higher or the same priority: appended unless
+        // of a higher priority than the last one.
+        void add_index(std::size_t pos, detail::iid_filter* added = nullptr)
+        {
+            if (dynamic_cast<const IExitCritical*>(intfs[pos].second)) exit_critical.push_back(pos);
+
+            std::span<const TIntfId> advertised;
+            if (detail::advertised_iids(intfs[pos].second, advertised)) {
+                const int priority = priorities[pos];
+                const auto rank = iid_slots.empty() || priorities[iid_slots.back()] >= priority
+                                      ? iid_slots.end()
+                                      : std::partition_point(iid_slots.begin(), iid_slots.end(), [&](auto slot) { return priorities[slot] >= priority; });
+                iids.insert(iids.begin() + (rank - iid_slots.begin()), advertised.begin(), advertised.end());
+                iid_slots.insert(rank, advertised.size(), pos);
+                for (auto iid : advertised) {
+                    own_filter.add(iid);
+                    if (added) added->add(iid);
+                }
+
+                if (iids.size() > hash_index_threshold) {
+                    if (index.empty()) {
+                        index.reserve(iids.size());
+                        for (std::size_t i = 0; i < iids.size(); i++) index.try_emplace(iids[i], iid_slots[i]);
+                    } else {
+                        for (auto iid : advertised) {
+                            if (const auto best = std::as_const(index).find(iid); !best) {
+                                index.try_emplace(iid, pos);
+                            } else if (priorities[*best] < priority) {
+                                *index.find(iid) = pos;
+                            }
+                        }
+                    }
+                }
+            } else {
+                unindexed.push_back(pos);
+                own_filter.saturate();
+                if (added) added->saturate();
+            }
+        }
+        // Disconnects the interface at intfs[pos], the other providers of its IIDs keep their ranks.
+        void remove(std::size_t pos)
+        {
+            gaps.insert(std::upper_bound(gaps.begin(), gaps.end(), pos), pos);
+            if (gaps.size() > std::max(min_gaps, intfs.size() / gap_ratio)) compact();
+        }
+        // Drops the gaps, the interfaces after them move back.
+        void compact()
+        {
+            constexpr auto gone = ~std::size_t{0};
+            std::vector<std::size_t> moved(intfs.size(), gone); // old position => new one
+            {
+                decltype(intfs) kept;
+                decltype(priorities) kept_priorities;
+                kept.reserve(size());
+                kept_priorities.reserve(size());
+                for (std::size_t pos = 0; pos < intfs.size(); pos++) {
+                    if (gap(pos)) continue;
+                    moved[pos] = kept.size();
+                    kept.push_back(intfs[pos]);
+                    kept_priorities.push_back(priorities[pos]);
+                }
+                intfs = std::move(kept);
+                priorities = std::move(kept_priorities);
+            }
+            {
+                decltype(iids) kept;
+                decltype(iid_slots) kept_slots;
+                for (std::size_t i = 0; i < iids.size(); i++) {
+                    if (moved[iid_slots[i]] == gone) continue;
+                    kept.push_back(iids[i]);
+                    kept_slots.push_back(moved[iid_slots[i]]);
+                }
+                iids = std::move(kept);
+                iid_slots = std::move(kept_slots);
+            }
+            for (auto positions : {&unindexed, &exit_critical}) {
+                std::remove_reference_t<decltype(*positions)> kept;
+                for (auto pos : *positions) {
+                    if (moved[pos] != gone) kept.push_back(moved[pos]);
+                }
+                *positions = std::move(kept);
+            }
+            gaps.clear();
+
+            index.clear();
+            if (iids.size() > hash_index_threshold) {
+                index.reserve(iids.size());
+                for (std::size_t i = 0; i < iids.size(); i++) index.try_emplace(iids[i], iid_slots[i]);
+            }
+            own_filter = {};
+            for (auto iid : iids) own_filter.add(iid);
+            if (!unindexed.empty()) own_filter.saturate();
+        }
+        void reindex()
+        {
+            iids.clear();
+            iid_slots.clear();
+            index.clear();
+            unindexed.clear();
+            exit_critical.clear();
+            gaps.clear();
+            own_filter = {};
+            priorities.resize(intfs.size(), 0);
+            for (std::size_t pos = 0; pos < intfs.size(); pos++) {
+                add_index(pos);
+            }
+        }
+
+        // intfs position of the best provider advertising iid, intfs.size() if none.
+        std::size_t indexed(TIntfId iid) const
+        {
+            if (!index.empty()) {
+                // past my entries if filled in place by the next version
+                const auto best = index.find(iid);
+                if (!best || *best >= intfs.size()) return intfs.size();
+                if (!gap(*best)) return *best;
+            }
+            // the first entry connected
+            const std::span<const TIntfId> all = iids;
+            for (auto i = detail::find_iid(all, iid); i < all.size(); i += 1 + detail::find_iid(all.subspan(i + 1), iid)) {
+                if (!gap(iid_slots[i])) return iid_slots[i];
+            }
+            return intfs.size();
+        }
+
+        // Calls resolved(pos) on my interfaces in search order until it returns true: the interfaces not advertising
+        // their IIDs connected before the best provider, then the best provider.
+        // Unless it resolves iid (searched by the caller): the other providers by rank, then the other interfaces
+        // not advertising their IIDs.
+        template <typename F>
+        bool search(TIntfId iid, F&& resolved) const
+        {
+            const auto hit = indexed(iid);
+            for (auto pos : unindexed) {
+                if (pos >= hit) break;
+                if (!gap(pos) && resolved(pos)) return true;
+            }
+            if (hit == intfs.size()) return false;
+            if (resolved(hit)) return true;
+
+            const std::span<const TIntfId> all = iids;
+            for (auto i = detail::find_iid(all, iid); i < all.size(); i += 1 + detail::find_iid(all.subspan(i + 1), iid)) {
+                if (iid_slots[i] != hit && !gap(iid_slots[i]) && resolved(iid_slots[i])) return true;
+            }
+            for (auto pos : unindexed) {
+                if (pos > hit && !gap(pos) && resolved(pos)) return true;
+            }
+            return false;
+        }
+    };
+
+    // Positions of the interfaces connected in the latest version of the lists, by address, for the writers: in one
+    // flat array (open addressing, linear probing), the addresses are read from the lists.
+    class Positions
+    {
+    public:
+        // the position of intf in l, l.intfs.size() if not connected
+        std::size_t find(const Links& l, const IInterfaceEx* intf) const
+        {
+            if (_size == 0) return l.intfs.size();
+            for (auto i = home(intf);; i = next(i)) {
+                if (_slots[i] == npos) return l.intfs.size();
+                if (l.intfs[_slots[i]].second == intf) return _slots[i];
+            }
+        }
+        // the interface connected at pos in l
+        void insert(const Links& l, std::size_t pos)
+        {
+            if ((_size + 1) * 4 > _slots.size() * 3) {
+                auto old = std::move(_slots);
+                resize(_size + 1);
+                for (auto p : old) {
+                    if (p != npos) place(l, p);
+                }
+            }
+            place(l, pos);
+        }
+        // the interface disconnected at pos in l (still in its lists)
+        void erase(const Links& l, std::size_t pos)
+        {
+            auto hole = home(l.intfs[pos].second);
+            while (_slots[hole] != pos) hole = next(hole);
+            // moves back the entries of the cluster which would not be found past the hole
+            for (auto i = next(hole); _slots[i] != npos; i = next(i)) {
+                const auto h = home(l.intfs[_slots[i]].second);
+                const bool reachable = hole <= i ? (hole < h && h <= i) : (hole < h || h <= i);
+                if (!reachable) {
+                    _slots[hole] = _slots[i];
+                    hole = i;
+                }
+            }
+            _slots[hole] = npos;
+            _size--;
+        }
+        // the interfaces connected in l
+        void rebuild(const Links& l)
+        {
+            resize(l.size());
+            for (std::size_t pos = 0; pos < l.intfs.size(); pos++) {
+                if (!l.gap(pos)) place(l, pos);
+            }
+        }
+
+    private:
+        static constexpr std::uint32_t npos = ~std::uint32_t{0}; // empty slot
+        std::vector<std::uint32_t> _slots{}; // 2^_bits, at most 3/4 full
+        unsigned _bits{0};
+        std::size_t _size{0};
+
+        std::size_t home(const IInterfaceEx* intf) const
+        {
+            return static_cast<std::size_t>((static_cast<std::uint64_t>(reinterpret_cast<std::uintptr_t>(intf)) * 0x9E3779B97F4A7C15ULL) >> (64 - _bits));
+        }
+        std::size_t next(std::size_t i) const
+        {
+            return (i + 1) & (_slots.size() - 1);
+        }
+        // empty, with room for n entries
+        void resize(std::size_t n)
+        {
+            _bits = std::bit_width(n + n / 3);
+            _slots.assign(std::size_t{1} << _bits, npos);
+            _size = 0;
+        }
+        void place(const Links& l, std::size_t pos)
+        {
+            auto i = home(l.intfs[pos].second);
+            while (_slots[i] != npos) i = next(i);
+            _slots[i] = static_cast<std::uint32_t>(pos);
+            _size++;
+        }
+    };
+
+    int _level; // busLevel
+    mutable std::recursive_mutex _mutex; // writers only
+
+    std::atomic<std::shared_ptr<const Links>> _links{std::make_shared<const Links>()};
+    // Read-side sections dereferencing the siblings and the parents, which are not owned.
+    mutable detail::grace_period _readers{};
+
+    std::vector<TBus*> _parents{}; // native buses having me in their buses (weak-referenced), under _mutex
+    Positions _positions{}; // under _mutex
+
+    // Topology epoch, bumped whenever anything reachable from this bus is connected, disconnected or finished.
+    std::atomic<std::uint64_t> _epoch{0};
+
+    // Summary of all the IIDs reachable from me, nullptr if not known. It grows with the connections made in the
+    // graph, and is rebuilt by the next query rooted here after a disconnection.
+    std::atomic<std::shared_ptr<const detail::iid_filter>> _reach{};
+
+    // Memoized iid => provider of queries rooted at this bus, nullptr for a miss. Valid for _routes_epoch only.
+    // Readers skip it rather than waiting for the lock.
+    struct Route {
+        IInterfaceEx* provider;
+        std::shared_ptr<const void> pin; // keeps the provider connected
+    };
+    std::mutex _routes_mutex;
+    std::unordered_map<TIntfId, Route> _routes{};
+    std::uint64_t _routes_epoch{0};
+
+    // Interfaces resolved by queryAll(), in resolution order, referenced.
+    struct Providers : std::vector<IInterface*> {
+        Providers() = default;
+        Providers(const Providers&) = delete;
+        Providers& operator=(const Providers&) = delete;
+        ~Providers()
+        {
+            for (auto p : *this) p->unref();
+        }
+        void add(IInterface* p)
+        {
+            if (std::find(begin(), end(), p) == end()) {
+                push_back(p);
+            } else {
+                p->unref(); // provided again (ex: by a bus reached twice through a foreign bus)
+            }
+        }
+    };
+    // Memoized iid => providers of queryAll() rooted at this bus, under _routes_mutex. Valid for _all_epoch only.
+    std::unordered_map<TIntfId, std::shared_ptr<const Providers>> _all{};
+    std::uint64_t _all_epoch{0};
+
+    // Compiled routes of the graph reachable from this bus, for queries rooted here: each reachable IID
+    // => its first provider in search order (my interfaces, siblings, then upper-level buses, recursively).
+    //
+    // Published atomically and resolved without locking. Only compiled when every reachable interface
+    // advertises its IIDs and every reachable bus is native, retired by any topology change.
+    struct Routes {
+        std::unordered_map<TIntfId, IInterfaceEx*> providers;
+        std::vector<std::shared_ptr<const Links>> pinned; // keeps the providers connected
+    };
+    std::atomic<std::shared_ptr<const Routes>> _snapshot{};
+    std::atomic<std::uint64_t> _uncompilable_epoch{~std::uint64_t{0}}; // epoch at which the graph could not be compiled
+
+    // The buses reachable from me by level, in findFirstBusByLevel() order: me, then my upper-level buses and
+    // my siblings, depth first. Rebuilt after a topology change, not published if a foreign bus is reachable
+    // (which is listed, but not searched).
+    struct Levels {
+        std::vector<std::pair<int, std::vector<IBus*>>> buses{}; // by level
+        bool complete{true};
+
+        const std::vector<IBus*>* find(int level) const
+        {
+            const auto it = std::lower_bound(buses.begin(), buses.end(), level, [](const auto& x, int l) { return x.first < l; });
+            return it != buses.end() && it->first == level ? &it->second : nullptr;
+        }
+    };
+    std::atomic<std::shared_ptr<const Levels>> _levels{};
+
+    std::atomic<std::size_t> _finish_workers{0}; // setFinishWorkers()
+    std::atomic<finish_order> _finish_order{finish_order::passes};
+    bool _abandoned{false}; // fastExit()
+
+    // dependent => the interfaces it depends on, and the interfaces started, by most derived object; the stragglers. Under _deps_mutex
+    std::mutex _deps_mutex;
+    std::unordered_map<const void*, std::vector<const void*>> _deps{};
+    std::unordered_set<const void*> _started{};
+    std::vector<straggler> _stragglers{};
+    std::atomic<std::chrono::milliseconds> _finish_timeout{std::chrono::milliseconds(0)}; // setFinishTimeout()
+    std::mutex _start_mutex; // start()
+
+    friend TBus* detail::dependency_recorder(IBus* bus);
+    friend void detail::note_dependency(TBus* bus, const void* self, IInterfaceEx* provider);
+
+    // The service created by a lazy interface, nullptr if none: it resolves from the bus as itself, both are the
+    // same dependency.
+    static const void* created_by(IInterfaceEx* intf)
+    {
+        auto lazy = dynamic_cast<const TLazyInterfaceEx*>(intf);
+        return lazy && lazy->created() ? dynamic_cast<const void*>(lazy->created()) : nullptr;
+    }
+
+    void depend(const void* dependent, const void* provider)
+    {
+        if (dependent == provider) return;
+
+        std::lock_guard lock(_deps_mutex);
+        auto& providers = _deps[dependent];
+        if (std::find(providers.begin(), providers.end(), provider) == providers.end()) providers.push_back(provider);
+    }
+    // an interface disconnected, its address might be reused
+    void forget(const void* intf)
+    {
+        std::lock_guard lock(_deps_mutex);
+        _started.erase(intf);
+        if (_deps.empty()) return;
+        _deps.erase(intf);
+        for (auto& [_, providers] : _deps) {
+            if (auto it = std::find(providers.begin(), providers.end(), intf); it != providers.end()) providers.erase(it);
+        }
+    }
+
+    // State of freeze(), owned by _freeze. _frozen publishes its routes to the lookups, dropped by topology changes
+    // still allowed (a sibling going away, finish()), freed by thaw() after a grace period.
+    struct Frozen {
+        detail::perfect_hash_map<IInterfaceEx*> routes{};
+        std::vector<std::shared_ptr<const Links>> pinned{}; // keeps the providers connected
+        std::vector<TBus*> buses{};                         // frozen along, referenced
+    };
+    std::unique_ptr<Frozen> _freeze{};
+    std::atomic<const Frozen*> _frozen{nullptr};
+    std::vector<std::unique_ptr<Frozen>> _graveyard{}; // GUARDED_BY(_mutex), thawed during a lookup, freed by awaitReaders()
+    std::atomic<int> _freezes{0};                       // number of freeze() covering this bus
+
+    std::shared_ptr<const Links> links() const
+    {
+        return _links.load(std::memory_order_acquire);
+    }
+
+    // Publishes a modified version of the connection lists, sharing them with the current one, under _mutex.
+    //
+    // The released objects are unref'd once the retired version, returned to the caller, is not used any more.
+    template <typename F>
+    std::shared_ptr<const Links> update(F&& modify, std::vector<IInterfaceEx*> released = {})
+    {
+        auto cur = links();
+        auto next = std::make_shared<Links>(*cur);
+        modify(*next);
+
+        cur->released = std::move(released);
+        cur->next = next;
+        _links.store(std::move(next), std::memory_order_release);
+        return cur;
+    }
+
+    void addParent(TBus* bus)
+    {
+        std::lock_guard lock(_mutex);
+        _parents.push_back(bus);
+    }
+    // The parent must not go away before awaitParentRemoval(), called without holding its lock: my touch()
+    // might still be walking up to it.
+    void removeParent(TBus* bus)
+    {
+        std::lock_guard lock(_mutex);
+        if (auto it = std::find(_parents.begin(), _parents.end(), bus); it != _parents.end()) _parents.erase(it);
+    }
+    void awaitParentRemoval(TBus* parent)
+    {
+        if (!awaitReaders()) keepAlive(parent);
+    }
+
+    // Keeps a bus unlinked from within a lookup of mine alive until my readers are gone, unless already going away
+    // (being destroyed from within the lookup: it is not waited for then).
+    void keepAlive(IBus* bus)
+    {
+        if (bus->count() == 0) return;
+        bus->ref();
+        _readers.defer([bus] { bus->unref(); });
+    }
+
+    // Waits for the lookups in progress, false if called from one of them. The frozen states thawed during a
+    // lookup before are freed then.
+    bool awaitReaders()
+    {
+        decltype(_graveyard) retired;
+        {
+            std::lock_guard lock(_mutex);
+            retired = std::exchange(_graveyard, {});
+        }
+        if (_readers.synchronize()) return true;
+
+        std::lock_guard lock(_mutex);
+        std::move(retired.begin(), retired.end(), std::back_inserter(_graveyard));
+        return false;
+    }
+
+    // Bumps the topology epoch of this bus and of every native bus the change is visible from, retiring
+    // their snapshots and cached routes.
+    //
+    // It is called without holding the lock of this bus.
+    //
+    // added: IIDs made reachable by the change, nullptr if some IIDs might be no longer reachable.
+    void touch(const detail::iid_filter* added = nullptr)
+    {
+        detail::QueryState visited;
+        touch(added, visited);
+    }
+    void touch(const detail::iid_filter* added, detail::QueryState& visited)
+    {
+        if (visited.searched(this)) return;
+        visited.mark(this);
+
+        decltype(_all) dropped; // released without holding any lock, nor reading
+        // The parents and siblings are not owned: they are walked within my read-side section, which
+        // they wait for (removeParent, removeSiblingBus) before going away.
+        detail::grace_period::reader reading(_readers);
+        std::vector<TBus*> upstream;
+        {
+            std::lock_guard lock(_mutex);
+            ++_epoch;
+            _snapshot.store(nullptr);
+            _frozen.store(nullptr);
+            _levels.store(nullptr);
+            if (!added) {
+                _reach.store(nullptr);
+            } else {
+                auto cur = _reach.load();
+                while (cur) {
+                    auto merged = std::make_shared<detail::iid_filter>(*cur);
+                    merged->merge(*added);
+                    if (_reach.compare_exchange_weak(cur, std::move(merged))) break;
+                }
+            }
+            {
+                std::lock_guard routes(_routes_mutex);
+                _routes.clear();
+                dropped.swap(_all);
+            }
+
+            upstream = _parents;
+            for (auto bus : links()->siblings) {
+                if (auto p = native(bus); p) upstream.push_back(p);
+            }
+        }
+        for (auto p : upstream) p->touch(added, visited);
+    }
+
+    // Summary of the IIDs reachable from a bus
+    static detail::iid_filter summary(IBus* bus)
+    {
+        if (auto p = native(bus); p) {
+            if (auto f = p->reach(); f) return *f;
+        }
+        detail::iid_filter f;
+        f.saturate(); // cannot tell
+        return f;
+    }
+
+    // The summary of reachable IIDs, rebuilt if needed. nullptr if a concurrent topology change got in the way.
+    std::shared_ptr<const detail::iid_filter> reach()
+    {
+        if (auto f = _reach.load(); f) return f;
+
+        const auto epoch = _epoch.load();
+        auto f = std::make_shared<detail::iid_filter>();
+        detail::QueryState visited;
+        summarize(*f, visited);
+
+        std::shared_ptr<const detail::iid_filter> published = std::move(f);
+        _reach.store(published);
+        if (_epoch.load() != epoch) { // stale, unless merged into since
+            auto expected = published;
+            _reach.compare_exchange_strong(expected, nullptr);
+            return nullptr;
+        }
+        return published;
+    }
+    void summarize(detail::iid_filter& f, detail::QueryState& visited)
+    {
+        if (f.saturated() || visited.searched(this)) return;
+        visited.mark(this);
+
+        detail::grace_period::reader reading(_readers);
+        const auto l = links();
+        f.merge(l->own_filter);
+        for (const auto* buses : {&l->siblings, &l->buses}) {
+            for (auto bus : *buses) {
+                if (auto p = native(bus); p) {
+                    p->summarize(f, visited);
+                } else {
+                    f.saturate();
+                }
+            }
+        }
+    }
+
+    // The level index, built if needed.
+    std::shared_ptr<const Levels> levels()
+    {
+        if (auto x = _levels.load(); x) return x;
+
+        const auto epoch = _epoch.load();
+        std::map<int, std::vector<IBus*>> found;
+        bool complete = true;
+        detail::QueryState visited;
+        index_levels(found, complete, visited);
+
+        auto x = std::make_shared<Levels>();
+        x->buses.assign(found.begin(), found.end());
+        x->complete = complete;
+        if (!complete) return x;
+
+        std::shared_ptr<const Levels> published = std::move(x);
+        _levels.store(published);
+        if (_epoch.load() != epoch) { // concurrent topology change, rebuilt next time
+            auto expected = published;
+            _levels.compare_exchange_strong(expected, nullptr);
+        }
+        return published;
+    }
+    // findFirstBusByLevel() traversal, each native bus is searched once.
+    IBus* walkLevel(int busLevel, detail::QueryState& visited)
+    {
+        if (busLevel < _level || visited.searched(this)) return nullptr;
+        visited.mark(this);
+        if (_level == busLevel) return this;
+
+        detail::grace_period::reader reading(_readers);
+        const auto l = links();
+        for (const auto* buses : {&l->buses, &l->siblings}) {
+            for (auto bus : *buses) {
+                auto p = native(bus);
+                if (auto found = p ? p->walkLevel(busLevel, visited) : bus->findFirstBusByLevel(busLevel); found) return found;
+            }
+        }
+        return nullptr;
+    }
+    void index_levels(std::map<int, std::vector<IBus*>>& found, bool& complete, detail::QueryState& visited)
+    {
+        if (visited.searched(this)) return;
+        visited.mark(this);
+        found[_level].push_back(this);
+
+        detail::grace_period::reader reading(_readers);
+        const auto l = links();
+        for (const auto* buses : {&l->buses, &l->siblings}) {
+            for (auto bus : *buses) {
+                if (auto p = native(bus); p) {
+                    p->index_levels(found, complete, visited);
+                } else if (!visited.searched(bus)) {
+                    visited.mark(bus);
+                    found[bus->level()].push_back(bus);
+                    complete = false;
+                }
+            }
+        }
+    }
+
+    // The published snapshot, compiled if needed. nullptr if the graph cannot be compiled.
+    std::shared_ptr<const Routes> compiled()
+    {
+        if (auto r = _snapshot.load(std::memory_order_acquire); r) return r;
+
+        const auto epoch = _epoch.load();
+        if (_uncompilable_epoch.load() == epoch) return nullptr;
+
+        auto r = std::make_shared<Routes>();
+        detail::QueryState visited;
+        if (!compile(*r, visited)) {
+            _uncompilable_epoch.store(epoch);
+            return nullptr;
+        }
+
+        std::shared_ptr<const Routes> published = std::move(r);
+        _snapshot.store(published);
+        if (_epoch.load() != epoch) { // concurrent topology change, try again next time
+            auto expected = published;
+            _snapshot.compare_exchange_strong(expected, nullptr);
+            return nullptr;
+        }
+        return published;
+    }
+    // Adds the routes from this bus in search order.
+    bool compile(Routes& r, detail::QueryState& visited)
+    {
+        if (visited.searched(this)) return true;
+        visited.mark(this);
+
+        detail::grace_period::reader reading(_readers);
+        auto l = links();
+        if (!l->advertised()) return false;
+
+        for (std::size_t i = 0; i < l->iids.size(); i++) {
+            // the best provider wins
+            if (!l->gap(l->iid_slots[i])) r.providers.try_emplace(l->iids[i], l->intfs[l->iid_slots[i]].second);
+        }
+        r.pinned.push_back(l);
+
+        for (const auto* buses : {&l->siblings, &l->buses}) {
+            for (auto bus : *buses) {
+                auto p = native(bus);
+                if (!p || !p->compile(r, visited)) return false;
+            }
+        }
+        return true;
+    }
+
+    // Freezes the native buses reachable from this one.
+    void freezeLinks(std::vector<TBus*>& frozen, detail::QueryState& visited)
+    {
+        detail::grace_period::reader reading(_readers);
+        const auto l = links();
+        for (const auto* buses : {&l->siblings, &l->buses}) {
+            for (auto bus : *buses) {
+                auto p = native(bus);
+                if (!p || visited.searched(p)) continue;
+                visited.mark(p);
+
+                {
+                    // no mutation in progress when returning
+                    std::lock_guard lock(p->_mutex);
+                    p->_freezes++;
+                }
+                p->ref();
+                frozen.push_back(p);
+                p->freezeLinks(frozen, visited);
+            }
+        }
+    }
+
+    // Resolves from the frozen routes, nothing if not frozen (or not any more).
+    std::optional<xp_error_code> lookupFrozen(TIntfId iid, IInterface** retIntf, detail::QueryState& qst)
+    {
+        detail::grace_period::reader reading(_readers);
+        const auto f = _frozen.load(std::memory_order_acquire);
+        if (!f) return std::nullopt;
+
+        const auto p = f->routes.find(iid);
+        if (!p) return xp_error_code::INTF_NOT_RESOLVED;
+
+        qst.depth++;
+        if (detail::resolve(*p, iid, retIntf, qst) == xp_error_code::OK) {
+            if (!qst.provider) qst.provider = *p;
+            return xp_error_code::OK;
+        }
+        qst.depth--; // the provider has been searched by the caller, walk the graph
+        return std::nullopt;
+    }
+
+    // An interface advertising its IIDs is a bus only if it advertises IID_IBUS, the others are probed.
+    static bool is_bus(IInterfaceEx* intf)
+    {
+        std::span<const TIntfId> advertised;
+        if (detail::advertised_iids(intf, advertised)) {
+            return std::find(advertised.begin(), advertised.end(), IID_IBUS) != advertised.end();
+        }
+
+        IBus* bus{nullptr};
+        detail::QueryState qst;
+        if (intf->queryInterfaceEx(IID_IBUS, (IInterface**)&bus, qst) != xp_error_code::OK) return false; // NOLINT
+        bus->unref();
+        return true;
+    }
+
+    // IIDs answered by the bus itself
+    static bool self(TIntfId iid)
+    {
+        return equalIID(iid, IID_IBUS) || equalIID(iid, IID_IBUSEX) || equalIID(iid, IID_IINTERFACEEX) || equalIID(iid, IID_IINTERFACE);
+    }
+
+    // Interface of a batch query, resolved from the interface itself
+    static xp_error_code resolveOne(IInterfaceEx* intf, TIntfId iid, IInterface** retIntf, IBus* host)
+    {
+        detail::QueryState qst;
+        qst.mark(host); // the batch traversal searches the bus network
+        return detail::resolve(intf, iid, retIntf, qst);
+    }
+
+    // queryInterfaces() from the frozen or compiled routes.
+    void lookupMany(std::span<const TIntfId> iids, std::span<IInterface*> retIntfs, std::vector<bool>& searched, std::size_t& pending)
+    {
+        detail::grace_period::reader reading(_readers);
+        const auto frozen = _frozen.load(std::memory_order_acquire);
+        const auto routes = frozen ? nullptr : compiled();
+        if (!frozen && !routes) return;
+
+        for (std::size_t i = 0; i < iids.size(); i++) {
+            if (retIntfs[i] || searched[i]) continue;
+
+            IInterfaceEx* provider{nullptr};
+            if (frozen) {
+                if (auto p = frozen->routes.find(iids[i]); p) provider = *p;
+            } else if (auto it = routes->providers.find(iids[i]); it != routes->providers.end()) {
+                provider = it->second;
+            }
+
+            if (!provider) {
+                searched[i] = true;
+                pending--;
+            } else if (resolveOne(provider, iids[i], &retIntfs[i], this) == xp_error_code::OK) {
+                pending--;
+            }
+        }
+    }
+
+    // queryInterfaces() traversal, each native bus is searched once for all of the pending iids.
+    void walkMany(std::span<const TIntfId> iids, std::span<IInterface*> retIntfs, const std::vector<bool>& searched, std::size_t& pending, detail::QueryState& visited)
+    {
+        if (visited.searched(this)) return;
+        visited.mark(this);
+
+        detail::grace_period::reader reading(_readers);
+        const auto l = links();
+
+        // in the same order as walk() for each of them
+        for (std::size_t i = 0; i < iids.size() && pending > 0; i++) {
+            if (retIntfs[i] || searched[i]) continue;
+
+            if (l->search(iids[i], [&](std::size_t pos) { return resolveOne(l->intfs[pos].second, iids[i], &retIntfs[i], this) == xp_error_code::OK; })) {
+                pending--;
+            }
+        }
+
+        for (const auto* buses : {&l->siblings, &l->buses}) {
+            for (auto bus : *buses) {
+                if (pending == 0) return;
+
+                if (auto p = native(bus); p) {
+                    if (const auto f = p->_reach.load(); f) {
+                        bool reachable = false;
+                        for (std::size_t i = 0; i < iids.size() && !reachable; i++) {
+                            reachable = !retIntfs[i] && !searched[i] && f->may_contain(iids[i]);
+                        }
+                        if (!reachable) continue;
+                    }
+                    p->walkMany(iids, retIntfs, searched, pending, visited);
+                    continue;
+                }
+                // foreign bus: one query per iid
+                for (std::size_t i = 0; i < iids.size(); i++) {
+                    if (retIntfs[i] || searched[i]) continue;
+                    if (resolveOne(bus, iids[i], &retIntfs[i], this) == xp_error_code::OK) pending--;
+                }
+            }
+        }
+    }
+
+    // All of the providers of iid reachable from this bus, cached for the current topology epoch.
+    std::shared_ptr<const std::vector<IInterface*>> providers(TIntfId iid)
+    {
+        const auto epoch = _epoch.load();
+        if (std::unique_lock cache(_routes_mutex, std::try_to_lock); cache && _all_epoch == epoch) {
+            if (auto it = _all.find(iid); it != _all.end()) return it->second;
+        }
+
+        auto all = std::make_shared<Providers>();
+        bool cacheable = true;
+        if (self(iid)) {
+            this->ref();
+            all->add(this);
+            cacheable = false; // would keep me alive
+        } else if (const auto f = reach(); !f || f->may_contain(iid)) {
+            detail::QueryState visited;
+            collect(iid, *all, visited, cacheable);
+        }
+
+        if (cacheable) {
+            if (std::unique_lock cache(_routes_mutex, std::try_to_lock); cache && _epoch.load() == epoch) {
+                if (_all_epoch != epoch) {
+                    _all.clear();
+                    _all_epoch = epoch;
+                }
+                _all.try_emplace(iid, all);
+            }
+        }
+        return all;
+    }
+    // queryAll() traversal, in the same order as walk(). Only the first provider of a foreign bus is known,
+    // which is not cached then.
+    void collect(TIntfId iid, Providers& all, detail::QueryState& visited, bool& cacheable)
+    {
+        if (visited.searched(this)) return;
+        visited.mark(this);
+
+        detail::grace_period::reader reading(_readers);
+        const auto l = links();
+
+        // my interfaces in search order: the providers of iid by rank, and the ones not advertising any IID
+        l->search(iid, [&](std::size_t pos) {
+            IInterface* p{nullptr};
+            if (resolveOne(l->intfs[pos].second, iid, &p, this) == xp_error_code::OK) all.add(p);
+            return false;
+        });
+
+        for (const auto* buses : {&l->siblings, &l->buses}) {
+            for (auto bus : *buses) {
+                if (auto p = native(bus); p) {
+                    if (const auto f = p->_reach.load(); f && !f->may_contain(iid)) continue;
+                    p->collect(iid, all, visited, cacheable);
+                    continue;
+                }
+                cacheable = false;
+                IInterface* p{nullptr};
+                if (resolveOne(bus, iid, &p, this) == xp_error_code::OK) all.add(p);
+            }
+        }
+    }
+
+    // The bus is exactly a TBus (not a subclass or a foreign IBus), it can be traversed
+    // without going through the virtual IInterfaceEx protocol.
+    static TBus* native(IBus* bus)
+    {
+        return typeid(*bus) == typeid(TBus) ? static_cast<TBus*>(bus) : nullptr;
+    }
+
+    // Q is either the concrete detail::QueryState (fast path) or a foreign IQueryState.
+    template <typename Q>
+    xp_error_code query(TIntfId iid, IInterface** retIntf, Q& qst)
     {
         Expects(retIntf);
         *retIntf = nullptr;
 
-        if (equalIID(iid, IID_IBUS) || equalIID(iid, IID_IINTERFACEEX) || equalIID(iid, IID_IINTERFACE)) {
+        if (self(iid)) {
             *retIntf = this;
             this->ref();
             return xp_error_code::OK;
         }
 
-        std::lock_guard lock(_mutex);
+        if constexpr (std::is_same_v<Q, detail::QueryState>) {
+            // Visited once whichever path answers, so the visited set never depends on what is cached.
+            if (qst.searched(this)) return xp_error_code::INTF_NOT_RESOLVED;
+            qst.mark(this);
 
-        qst.addSearched(this);
+            if (qst.depth == 0) {
+                if (const auto ec = lookupFrozen(iid, retIntf, qst); ec) return *ec;
+
+                if (auto routes = compiled(); routes) {
+                    const auto it = routes->providers.find(iid);
+                    if (it == routes->providers.end()) return xp_error_code::INTF_NOT_RESOLVED;
+
+                    qst.depth++;
+                    if (detail::resolve(it->second, iid, retIntf, qst) == xp_error_code::OK) {
+                        if (!qst.provider) qst.provider = it->second;
+                        return xp_error_code::OK;
+                    }
+                    qst.depth--; // the provider has been searched by the caller, walk the graph
+                }
+            }
+
+            // definite miss: not reachable from here at all
+            const auto f = qst.depth == 0 ? reach() : _reach.load();
+            if (f && !f->may_contain(iid)) return xp_error_code::INTF_NOT_RESOLVED;
+
+            // Only a query rooted at this bus is cached: deeper in the traversal the result depends
+            // on what the caller has already searched.
+            if (qst.depth++ == 0) {
+                const auto epoch = _epoch.load();
+                if (std::unique_lock routes(_routes_mutex, std::try_to_lock); routes && _routes_epoch == epoch) {
+                    if (auto it = _routes.find(iid); it != _routes.end()) {
+                        const auto route = it->second;
+                        routes.unlock();
+                        if (!route.provider || route.provider->queryInterfaceEx(iid, retIntf, qst) != xp_error_code::OK) return xp_error_code::INTF_NOT_RESOLVED;
+                        if (!qst.provider) qst.provider = route.provider;
+                        return xp_error_code::OK;
+                    }
+                }
+
+                const auto ec = walk(iid, retIntf, qst);
+                if (qst.cacheable && (ec != xp_error_code::OK || qst.provider)) {
+                    if (std::unique_lock routes(_routes_mutex, std::try_to_lock); routes && _epoch.load() == epoch) {
+                        if (_routes_epoch != epoch) {
+                            _routes.clear();
+                            _routes_epoch = epoch;
+                        }
+                        _routes.try_emplace(iid, Route{ec == xp_error_code::OK ? qst.provider : nullptr, ec == xp_error_code::OK ? qst.pin : nullptr});
+                    }
+                }
+                return ec;
+            }
+        } else {
+            if (qst.isSearched(this)) return xp_error_code::INTF_NOT_RESOLVED;
+            qst.addSearched(this);
+        }
+
+        return walk(iid, retIntf, qst);
+    }
+
+    template <typename Q>
+    xp_error_code walk(TIntfId iid, IInterface** retIntf, Q& qst)
+    {
+        detail::grace_period::reader reading(_readers);
+        const auto l = links();
 
-        // scanning interfaces in my slots
-        for (auto [_, intf] : _intfs) {
-            if (resolve(intf, iid, retIntf, qst) == xp_error_code::OK) return xp_error_code::OK;
+        // interfaces in my slots: the best provider, unless a non-indexed interface connected before it resolves the iid
+        if (l->search(iid, [&](std::size_t pos) { return resolveSlot(l, pos, iid, retIntf, qst) == xp_error_code::OK; })) {
+            return xp_error_code::OK;
         }
         // scan sibling buses
-        for (auto bus : _siblings) {
-            if (resolve(bus, iid, retIntf, qst) == xp_error_code::OK) return xp_error_code::OK;
+        for (auto bus : l->siblings) {
+            if (visit(bus, iid, retIntf, qst) == xp_error_code::OK) return xp_error_code::OK;
         }
         // scanning connected upper-level/less-secure buses
-        for (auto bus : _buses) {
-            if (resolve(bus, iid, retIntf, qst) == xp_error_code::OK) return xp_error_code::OK;
+        for (auto bus : l->buses) {
+            if (visit(bus, iid, retIntf, qst) == xp_error_code::OK) return xp_error_code::OK;
         }
 
         return xp_error_code::INTF_NOT_RESOLVED;
     }
 
-protected:
-    ~TBus() override
+    template <typename Q>
+    static xp_error_code resolveSlot(const std::shared_ptr<const Links>& l, std::size_t pos, TIntfId iid, IInterface** retIntf, Q& qst)
     {
-        if (!this->finished()) reset();
+        auto intf = l->intfs[pos].second;
+        if (detail::resolve(intf, iid, retIntf, qst) != xp_error_code::OK) return xp_error_code::INTF_NOT_RESOLVED;
+
+        if constexpr (std::is_same_v<Q, detail::QueryState>) {
+            if (!qst.provider) {
+                qst.provider = intf;
+                qst.pin = l;
+            }
+        }
+        return xp_error_code::OK;
     }
 
-private:
-    int _level; // busLevel
-    mutable std::recursive_mutex _mutex;
+    template <typename Q>
+    static xp_error_code visit(IBus* bus, TIntfId iid, IInterface** retIntf, Q& qst)
+    {
+        if constexpr (std::is_same_v<Q, detail::QueryState>) {
+            if (auto p = native(bus); p) {
+                return qst.searched(p) ? xp_error_code::INTF_NOT_RESOLVED : p->query(iid, retIntf, qst);
+            }
+            qst.cacheable = false; // not notified of the topology changes behind a foreign bus
+        }
+        return detail::resolve(bus, iid, retIntf, qst);
+    }
+
+    enum class link_t {
+        NONE, // not connected
+        INTF,
+        BUS,
+        SIBLING,
+    };
+
+    // connect() without topology notification.
+    //
+    // For a connected interface, its advertised IIDs are added to the filter; a connected bus is
+    // returned instead, the caller summarizes it without holding my lock.
+    //
+    // No bus lock is held while calling into another bus, except the lock of a bus with a lower level than
+    // the one called into (addParent), which cannot wait for the former.
+    link_t link(gsl::not_null<IInterfaceEx*> intf, int order, int priority, detail::iid_filter& added, IBus*& linked)
+    {
+        std::lock_guard lock(_mutex);
+        if (frozen()) return link_t::NONE;
+        const auto cur = links();
+
+        IBus* bus{nullptr};
+        detail::QueryState qst;
+        if (intf->queryInterfaceEx(IID_IBUS, (IInterface**)&bus, qst) == xp_error_code::OK) { // NOLINT
+            ON_EXIT(bus->unref());                                                            // balance queryInterface
+
+            const int level = bus->level();
+            if (level > _level) {
+                // do not allow duplicated buses
+                if (auto it = std::find(cur->buses.begin(), cur->buses.end(), bus); it != cur->buses.end())
+                    return link_t::NONE;
+
+                // strong reference only for different level.
+                bus->ref();
+                update([bus](Links& l) {
+                    l.buses.push_back(bus);
+                    std::sort(l.buses.begin(), l.buses.end(), [](auto x, auto y) { return x->level() < y->level(); });
+                });
+                if (auto p = native(bus); p) p->addParent(this);
+                linked = bus;
+                return link_t::BUS;
+            }
+
+            if (level == _level) {
+                if (bus->count() == 1) {
+                    // sibing bus is not referenced outside.
+                    //
+                    // Because we only keep a weak reference to a sibling bus, which will be destroyed if there is no external
+                    // reference lock.
+                    // ex:  bus0->connect(new TBus(0));
+                    //
+                    // we could unrefNoDelete it to keep it alive after return, but it might lead to memory leakge if it is not
+                    // referenced later.
+                    // so we can avoid this kind of usage before bad things happens.
+                    return link_t::NONE;
+                }
+
+                // no loop-back
+                if (bus == this)
+                    return link_t::NONE;
+
+                // do not allow duplicated buses
+                if (auto it = std::find(cur->siblings.begin(), cur->siblings.end(), bus); it != cur->siblings.end())
+                    return link_t::NONE;
 
-    // IBus* _bus; //hosting bus with a more secure level ( _bus->level() <= this->level() )
-    std::vector<std::pair<int, IInterfaceEx*>> _intfs;
-    std::vector<IBus*> _buses{};           // connected buses with less secure levels ( >= this->level() ), strong-referenced.
-    std::unordered_set<IBus*> _siblings{}; // bus with the same level as mine. (weak-referenced)
+                // a frozen bus would not accept me
+                if (auto p = native(bus); p && p->frozen())
+                    return link_t::NONE;
+
+                // weak reference only for sibling bus to avoid reference deadlock, remove when being destroyed.
+                update([bus](Links& l) { l.siblings.push_back(bus); });
+                linked = bus;
+                return link_t::SIBLING;
+            }
+
+            // bus level smaller than mine, connection failure.
+            return link_t::NONE;
+        }
+
+        // no duplicated interfaces
+        if (_positions.find(*cur, intf) < cur->intfs.size()) return link_t::NONE;
+
+        intf->ref();
+        update([&](Links& l) { l.add(intf, order, priority, &added); });
+        _positions.insert(*links(), cur->intfs.size());
+        intf->setBus(this);
+        return link_t::INTF;
+    }
 
     void onClear() override
     {
-        std::lock_guard lock(_mutex);
+        if (_abandoned) return;
+        thaw();
         reset();
     }
 
+    void abandon(detail::QueryState& visited)
+    {
+        visited.mark(this);
+        if (this->finished()) return;
+
+        _abandoned = true;
+        const auto l = links(); // never released
+
+        std::vector<std::pair<int, IInterfaceEx*>> critical;
+        for (auto pos : l->exit_critical) {
+            if (l->gap(pos)) continue;
+            if (dynamic_cast<const IExitCritical*>(l->intfs[pos].second)->finishAtExit()) critical.push_back(l->intfs[pos]);
+        }
+        std::optional<detail::worker_pool> pool;
+        if (const auto workers = std::min(_finish_workers.load(), critical.size()); workers > 1) pool.emplace(workers);
+        if (_finish_order.load() == finish_order::dependencies) {
+            finishByDependencies(critical, pool);
+        } else {
+            finishByPasses(critical, pool);
+        }
+        pool.reset();
+        this->finish();
+
+        // not released, but the siblings might be: they no longer reach me
+        std::vector<IBus*> siblings;
+        {
+            std::lock_guard lock(_mutex);
+            siblings.assign(l->siblings.begin(), l->siblings.end());
+            update([](Links& cur) { cur.siblings.clear(); });
+        }
+        for (auto p : siblings) p->removeSiblingBus(this);
+
+        for (auto it = l->buses.rbegin(); it != l->buses.rend(); ++it) {
+            if (auto p = native(*it); p) {
+                if (!visited.searched(p)) p->abandon(visited);
+            } else {
+                (*it)->finish();
+            }
+        }
+    }
+
+    // explicitly pass-ordered resource release
+    // for the same pass, the later installed interface is released first.
+    void finishByPasses(const std::vector<std::pair<int, IInterfaceEx*>>& intfs, std::optional<detail::worker_pool>& pool)
+    {
+        std::vector<int> passes;
+        passes.reserve(intfs.size());
+        for (auto [order, _] : intfs) passes.push_back(order);
+        std::sort(passes.begin(), passes.end());
+        passes.erase(std::unique(passes.begin(), passes.end()), passes.end());
+
+        for (int pass : passes) {
+            const auto deadline = finishDeadline();
+            std::mutex mutex; // of draining
+            std::vector<std::pair<IInterfaceEx*, std::future<void>>> draining;
+            auto finish = [&](IInterfaceEx* intf) {
+                if (auto done = finishOne(intf); done.valid()) {
+                    std::lock_guard lock(mutex);
+                    draining.emplace_back(intf, std::move(done));
+                }
+            };
+            for (auto it = intfs.rbegin(); it != intfs.rend(); ++it) {
+                auto [order, intf] = *it;
+                if (pass == order) {
+                    if (pool) {
+                        pool->submit([&finish, intf] { finish(intf); });
+                    } else {
+                        finish(intf);
+                    }
+                }
+            }
+            if (pool) pool->wait();
+            awaitDrains(draining, deadline); // the pass is over
+        }
+    }
+
+    // Finishes intf, returns its pending drain if any (IAsyncFinish).
+    static std::future<void> finishOne(IInterfaceEx* intf)
+    {
+        if (auto p = dynamic_cast<IAsyncFinish*>(intf); p) return p->finishAsync();
+        intf->finish();
+        return {};
+    }
+
+    // Of the drains started now, no deadline if no timeout.
+    std::optional<std::chrono::steady_clock::time_point> finishDeadline() const
+    {
+        if (const auto timeout = _finish_timeout.load(); timeout.count() > 0) return std::chrono::steady_clock::now() + timeout;
+        return std::nullopt;
+    }
+
+    // Waits for the drains, until the deadline if any: the interfaces still draining then are stragglers.
+    // Rethrows the first exception of a drain.
+    void awaitDrains(std::vector<std::pair<IInterfaceEx*, std::future<void>>>& draining, std::optional<std::chrono::steady_clock::time_point> deadline)
+    {
+        std::exception_ptr error;
+        for (auto& [intf, done] : draining) {
+            if (deadline && done.wait_until(*deadline) == std::future_status::timeout) {
+                std::lock_guard lock(_deps_mutex);
+                _stragglers.push_back({auto_ref<IInterfaceEx>(intf), std::move(done)});
+                continue;
+            }
+            try {
+                done.get();
+            } catch (...) {
+                if (!error) error = std::current_exception();
+            }
+        }
+        if (error) std::rethrow_exception(error);
+    }
+
+    // An interface is finished once its dependents connected to this bus are, the last connected first
+    // among the ones ready. Then the ones left in a cycle.
+    void finishByDependencies(const std::vector<std::pair<int, IInterfaceEx*>>& intfs, std::optional<detail::worker_pool>& pool)
+    {
+        const auto n = intfs.size();
+        std::unordered_map<const void*, std::size_t> pos;
+        pos.reserve(n);
+        for (std::size_t i = 0; i < n; i++) {
+            pos.emplace(dynamic_cast<const void*>(intfs[i].second), i);
+            if (auto created = created_by(intfs[i].second); created) pos.emplace(created, i);
+        }
+
+        std::vector<std::vector<std::size_t>> providers(n);
+        std::vector<std::size_t> dependents(n, 0); // not finished yet
+        {
+            std::lock_guard lock(_deps_mutex);
+            for (const auto& [dependent, used] : _deps) {
+                const auto d = pos.find(dependent);
+                if (d == pos.end()) continue;
+                for (auto provider : used) {
+                    if (const auto p = pos.find(provider); p != pos.end() && p->second != d->second) {
+                        providers[d->second].push_back(p->second);
+                        dependents[p->second]++;
+                    }
+                }
+            }
+        }
+
+        // a dependent is drained before its providers are finished, the other drains are awaited together
+        const auto deadline = finishDeadline();
+        std::mutex mutex; // of draining
+        std::vector<std::pair<IInterfaceEx*, std::future<void>>> draining;
+        auto finish = [&](std::size_t i) {
+            auto done = finishOne(intfs[i].second);
+            if (!done.valid()) return;
+            if (providers[i].empty()) {
+                std::lock_guard lock(mutex);
+                draining.emplace_back(intfs[i].second, std::move(done));
+                return;
+            }
+            std::vector<std::pair<IInterfaceEx*, std::future<void>>> dependent;
+            dependent.emplace_back(intfs[i].second, std::move(done));
+            awaitDrains(dependent, deadline);
+        };
+        const auto finished = detail::run_ordered(providers, std::move(dependents), false, finish, pool ? &*pool : nullptr);
+        for (auto i = n; i-- > 0;) {
+            if (!finished[i]) finish(i);
+        }
+        awaitDrains(draining, deadline);
+    }
+
+    // The lock is only held to publish the changes, not while finishing the connected objects.
     void reset()
     {
-        std::lock_guard lock(_mutex);
         Expects(!this->finished());
 
-        for (auto p : _siblings) {
+        std::vector<IBus*> siblings;
+        {
+            std::lock_guard lock(_mutex);
+            const auto cur = links();
+            siblings.assign(cur->siblings.begin(), cur->siblings.end());
+            update([](Links& l) { l.siblings.clear(); });
+        }
+        for (auto p : siblings) {
             p->removeSiblingBus(this);
             // sibling bus not affected by my clearance.
             // p->finish();
         }
-        _siblings.clear();
 
-        // explicitly pass-ordered resource release
-        // for the same pass, the later installed interface is released first.
-        constexpr int max_clear_pass = 3;
-        for (int pass = 0; pass < max_clear_pass; pass++) {
-            for (auto it = _intfs.rbegin(); it != _intfs.rend(); ++it) {
-                auto [order, intf] = *it;
-                if (pass == order) {
-                    intf->finish();
-                }
-            }
+        // nothing will be reachable from here any more
+        touch();
+
+        // (copied: a retired version held here would defer the release of what is disconnected meanwhile)
+        const auto intfs = links()->connected();
+        std::optional<detail::worker_pool> pool;
+        if (const auto workers = std::min(_finish_workers.load(), intfs.size()); workers > 1) pool.emplace(workers);
+        if (_finish_order.load() == finish_order::dependencies) {
+            finishByDependencies(intfs, pool);
+        } else {
+            finishByPasses(intfs, pool);
         }
-        for (auto [_, intf] : _intfs) {
-            intf->setBus(nullptr);
-            intf->unref();
+        {
+            std::lock_guard deps(_deps_mutex);
+            _deps.clear();
+            _started.clear();
         }
-        _intfs.clear();
+        {
+            std::lock_guard lock(_mutex);
+            std::vector<IInterfaceEx*> released;
+            for (auto [_, intf] : links()->connected()) {
+                intf->setBus(nullptr);
+                released.push_back(intf);
+            }
+            update(
+                [](Links& l) {
+                    l.intfs.clear();
+                    l.reindex();
+                },
+                std::move(released));
+            _positions.rebuild(*links());
+        }
+        touch();
 
-        for (std::vector<IBus*>::reverse_iterator it = _buses.rbegin(); it != _buses.rend(); ++it) {
+        const auto buses = links()->buses;
+        for (auto it = buses.rbegin(); it != buses.rend(); ++it) {
             IBus* bus = *it;
             bus->finish();
             bus->setBus(nullptr);
-            bus->unref();
+            if (auto p = native(bus); p) {
+                p->removeParent(this);
+                p->awaitParentRemoval(this);
+            }
+            {
+                std::lock_guard lock(_mutex);
+                update([bus](Links& l) { l.buses.erase(std::find(l.buses.begin(), l.buses.end(), bus)); }, {bus});
+            }
+            touch();
         }
-        _buses.clear();
     }
 };
 
+namespace detail {
+inline TBus* dependency_recorder(IBus* bus)
+{
+    auto p = TBus::native(bus);
+    return p && p->_finish_order.load(std::memory_order_relaxed) == TBus::finish_order::dependencies ? p : nullptr;
+}
+inline void note_dependency(TBus* bus, const void* self, IInterfaceEx* provider)
+{
+    bus->depend(self, dynamic_cast<const void*>(provider));
+}
+} // namespace detail
+
 } // namespace xp
 
 #endif /* IMPL_INTFS_H_ */
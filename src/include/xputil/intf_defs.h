@@ -2,6 +2,8 @@
 #define _XP_INTF_DEFS_H_
 
 #include <cstddef>
+#include <future>
+#include <span>
 #include <stdexcept>
 #include <unordered_set>
 #include <string>
@@ -67,11 +69,15 @@ using TIntfId = decltype(calc_iid(""));
 //#define DECLARE_IID(x) constexpr static auto iid = x
 
 
-#define DECLARE_IID(x)                   \
-    inline static auto iid()             \
-    {                                    \
-        static auto h = xp::calc_iid(x); \
-        return h;                        \
+#define DECLARE_IID(x)                             \
+    inline static auto iid()                       \
+    {                                              \
+        static auto h = xp::calc_iid(x);           \
+        return h;                                  \
+    }                                              \
+    constexpr static const char* iid_name()        \
+    {                                              \
+        return x;                                  \
     }
 
 
@@ -230,6 +236,86 @@ struct IInterfaceEx : public IInterface {
 
 #define IID_IINTERFACEEX IID(IInterfaceEx)
 
+/**
+ * \interface IIntfManifest
+ * \brief optional protocol of an IInterfaceEx implementation to advertise the IIDs it resolves by itself.
+ *
+ * A bus asks for it once when the interface is connected, and then finds the interface by
+ * IID without calling its queryInterfaceEx() for every other IID being resolved.
+ *
+ * Opt-in (see TIntfManifest, implied by TInterfaceEx<T> and TMultiInterfaceEx<T, S...> used as they are):
+ * an implementation not implementing it is searched as usual. The advertised list must be complete
+ * (IID_IINTERFACE and IID_IINTERFACEEX excluded), an IID missing from it is not resolved from the
+ * interface through its bus.
+ */
+struct IIntfManifest {
+    /**
+     * Returns false if the implementation cannot tell, the interface is then searched as usual.
+     */
+    virtual bool providedIids(std::span<const TIntfId>& iids) const = 0;
+
+protected:
+    ~IIntfManifest() = default;
+};
+
+/**
+ * \interface IStartable
+ * \brief optional protocol of an IInterfaceEx implementation started by its bus (TBus::start()).
+ *
+ * The interfaces a service needs to start are started before, if started by the same bus: the services
+ * independent of each other can be started concurrently.
+ */
+struct IStartable {
+    /**
+     * IIDs of the interfaces start() uses.
+     */
+    virtual std::span<const TIntfId> startDependencies() const = 0;
+    /**
+     * Called once connected, before serving.
+     */
+    virtual void start() = 0;
+
+protected:
+    ~IStartable() = default;
+};
+
+/**
+ * \interface IAsyncFinish
+ * \brief optional protocol of an IInterfaceEx implementation draining queues when finished (ex: network or disk).
+ *
+ * A bus calls finishAsync() instead of finish(), and awaits the drains of the interfaces finished together
+ * at once: they overlap instead of adding up.
+ */
+struct IAsyncFinish {
+    /**
+     * Finishes as finish() does, without waiting for what is still draining. Called again once finished,
+     * nothing is left to drain.
+     *
+     * @return completed once drained, invalid if nothing is left to drain
+     */
+    virtual std::future<void> finishAsync() = 0;
+
+protected:
+    ~IAsyncFinish() = default;
+};
+
+/**
+ * \interface IExitCritical
+ * \brief optional protocol of an IInterfaceEx implementation with side effects outside of the process.
+ *
+ * A fast exit (TBus::fastExit()) only finishes the interfaces implementing it, the others are neither
+ * finished nor released: ex: a service with buffered writes to flush.
+ */
+struct IExitCritical {
+    /**
+     * Returns false if finish() can be skipped at exit after all (ex: nothing left to flush).
+     */
+    virtual bool finishAtExit() const = 0;
+
+protected:
+    ~IExitCritical() = default;
+};
+
 /**
  * @brief Try resolving an interface from an interface extension.
  *
@@ -341,6 +427,96 @@ struct [[nodiscard]] IEnumeratorEx : public IRefObj {
     virtual void rewind() = 0;
 };
 
+/**
+ * \interface IBusEx
+ * \brief IBus extensions
+ */
+struct IBusEx : public IBus {
+    DECLARE_IID("00596FC4-54A0-478B-87AC-14469C277270");
+
+    /**
+     * @brief Resolve multiple interfaces in one traversal of the bus network.
+     *
+     * Each bus of the network is searched once for all of the iids, instead of once per queryInterface().
+     *
+     * @param iids unique ids of the interfaces to resolve
+     * @param retIntfs [out] retIntfs[i] is the interface resolved for iids[i] (referenced as by queryInterface()),
+     * nullptr if not resolved. Must be as large as iids.
+     *
+     * @return the number of interfaces resolved
+     */
+    virtual std::size_t queryInterfaces(std::span<const TIntfId> iids, std::span<IInterface*> retIntfs) = 0;
+
+    /**
+     * @brief Enumerate all of the providers of an interface reachable from this bus.
+     *
+     * The providers are listed in resolution order: the first one is what queryInterface() resolves,
+     * then the ones it would resolve if the former were disconnected, and so on. Each provider is listed once.
+     *
+     * @param iid unique id of the interface
+     *
+     * @return the enumerator of the interfaces resolved for iid, referenced, empty if none. The interfaces
+     * are not referenced, they are valid until the enumerator is released.
+     */
+    virtual IEnumeratorEx<IInterface*>* queryAll(TIntfId iid) = 0;
+
+    /**
+     * @brief Enumerate all of the buses of a level reachable from this bus.
+     *
+     * The buses are listed in search order: the first one is what findFirstBusByLevel() returns. Buses are
+     * reached through upper-level and sibling buses, but not beyond a bus of another implementation.
+     *
+     * @param busLevel level of the buses
+     *
+     * @return the enumerator of the buses, referenced, empty if none. The buses are not referenced, they are
+     * valid as long as they stay connected.
+     */
+    virtual IEnumeratorEx<IBus*>* findBusesByLevel(int busLevel) = 0;
+
+    /**
+     * @brief Connect many interfaces at once.
+     *
+     * The same as connect() for each of them, in order, but the connections are published at once.
+     *
+     * @param intfs interfaces or buses to connect
+     * @param order finish() order of the interfaces
+     *
+     * @return the number of interfaces connected (the ones already connected, or failing to connect, are skipped)
+     */
+    virtual std::size_t connectMany(std::span<IInterfaceEx* const> intfs, int order = 0) = 0;
+
+    /**
+     * @brief Connect an interface ranked among the other providers of its interfaces.
+     *
+     * An interface id is resolved by its provider of the highest priority on this bus, the first connected
+     * one among equals: an optimized implementation can be connected over a fallback, which resolves the
+     * interface again once the former is disconnected. connect() ranks an interface at priority 0.
+     *
+     * Only the providers advertising their interface ids (IIntfManifest, or TInterfaceEx<T> as is) are ranked,
+     * the priority is ignored for a bus.
+     *
+     * @param intf interface or bus to connect
+     * @param priority rank of the interface, independent of its finish() order
+     * @param order finish() order of the interface
+     *
+     * @return true if connected
+     */
+    [[nodiscard]] virtual bool connectRanked(gsl::not_null<IInterfaceEx*> intf, int priority, int order = 0) = 0;
+
+    /**
+     * @brief Declare that a connected interface depends on another one.
+     *
+     * When finishing in dependency order, provider is finished after dependent. A dependency on an interface
+     * connected to another bus is ignored by this bus.
+     *
+     * @param dependent interface using provider
+     * @param provider interface used by dependent
+     */
+    virtual void addDependency(gsl::not_null<IInterfaceEx*> dependent, gsl::not_null<IInterfaceEx*> provider) = 0;
+};
+
+#define IID_IBUSEX IID(IBusEx)
+
 //----- Helper ------
 /**
  * \class auto_ref
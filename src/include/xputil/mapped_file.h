@@ -0,0 +1,82 @@
+#ifndef XP_MAPPED_FILE_H
+#define XP_MAPPED_FILE_H
+
+#include <cstddef>
+#include <string>
+
+#if defined(_WIN_)
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace xp::detail {
+
+// A file mapped read-only in memory, unmapped when destroyed. Empty if it cannot be mapped.
+class mapped_file
+{
+public:
+    explicit mapped_file(const std::string& path)
+    {
+#if defined(_WIN_)
+        HANDLE file = ::CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (file == INVALID_HANDLE_VALUE) return;
+        LARGE_INTEGER size;
+        if (::GetFileSizeEx(file, &size) && size.QuadPart > 0) {
+            if (HANDLE mapping = ::CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr); mapping) {
+                _data = ::MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+                if (_data) _size = static_cast<std::size_t>(size.QuadPart);
+                ::CloseHandle(mapping);
+            }
+        }
+        ::CloseHandle(file);
+#else
+        const int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) return;
+        struct stat st;
+        if (::fstat(fd, &st) == 0 && st.st_size > 0) {
+            void* p = ::mmap(nullptr, static_cast<std::size_t>(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+            if (p != MAP_FAILED) {
+                _data = p;
+                _size = static_cast<std::size_t>(st.st_size);
+            }
+        }
+        ::close(fd);
+#endif
+    }
+    mapped_file(const mapped_file&) = delete;
+    mapped_file& operator=(const mapped_file&) = delete;
+    ~mapped_file()
+    {
+        if (!_data) return;
+#if defined(_WIN_)
+        ::UnmapViewOfFile(_data);
+#else
+        ::munmap(_data, _size);
+#endif
+    }
+
+    const unsigned char* data() const
+    {
+        return static_cast<const unsigned char*>(_data);
+    }
+    std::size_t size() const
+    {
+        return _size;
+    }
+    bool empty() const
+    {
+        return _data == nullptr;
+    }
+
+private:
+    void* _data{nullptr};
+    std::size_t _size{0};
+};
+
+} // namespace xp::detail
+
+#endif
@@ -0,0 +1,117 @@
+#ifndef XP_PERFECT_HASH_H
+#define XP_PERFECT_HASH_H
+
+#include "intf_defs.h"
+
+#include <algorithm>
+#include <bit>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+namespace xp::detail {
+
+/**
+ * Immutable IID => V map, built once over a fixed set of IIDs with a perfect hash.
+ *
+ * Keys are first spread over small buckets, then each bucket gets a pilot value moving all of its keys
+ * into free slots (hash and displace). A lookup is two multiplications and two loads, without probing.
+ * V must be default constructible, a default value marks an empty slot.
+ */
+template <typename V>
+class perfect_hash_map
+{
+public:
+    perfect_hash_map() = default;
+
+    // keys must be unique
+    explicit perfect_hash_map(const std::vector<std::pair<TIntfId, V>>& items)
+    {
+        for (unsigned slots_log2 = std::bit_width(items.size() + items.size() / 4);; slots_log2++) {
+            if (build(items, slots_log2)) return;
+        }
+    }
+
+    const V* find(TIntfId iid) const
+    {
+        if (_slots.empty()) return nullptr;
+
+        const auto& slot = _slots[slot_of(iid, _pilots[bucket_of(iid)])];
+        return slot.first == iid && slot.second != V{} ? &slot.second : nullptr;
+    }
+
+    std::size_t size() const
+    {
+        return _size;
+    }
+
+private:
+    static constexpr std::uint32_t max_pilot = 1U << 16;
+
+    unsigned _buckets_log2{0};
+    unsigned _slots_log2{0};
+    std::vector<std::uint32_t> _pilots{};
+    std::vector<std::pair<TIntfId, V>> _slots{};
+    std::size_t _size{0};
+
+    // top bits of a multiplicative hash, 0 for 0 bits
+    static std::size_t top(std::uint64_t h, unsigned bits)
+    {
+        return bits == 0 ? 0 : static_cast<std::size_t>(h >> (64 - bits));
+    }
+    std::size_t bucket_of(TIntfId iid) const
+    {
+        return top(static_cast<std::uint64_t>(iid) * 0x9E3779B97F4A7C15ULL, _buckets_log2);
+    }
+    std::size_t slot_of(TIntfId iid, std::uint32_t pilot) const
+    {
+        const auto h = (static_cast<std::uint64_t>(iid) ^ (pilot * 0xC2B2AE3D27D4EB4FULL)) * 0xFF51AFD7ED558CCDULL;
+        return top(h ^ (h >> 29), _slots_log2);
+    }
+
+    bool build(const std::vector<std::pair<TIntfId, V>>& items, unsigned slots_log2)
+    {
+        _slots_log2 = slots_log2;
+        _buckets_log2 = std::bit_width(items.size() / 4); // ~4 keys per bucket
+        _pilots.assign(std::size_t{1} << _buckets_log2, 0);
+        _slots.assign(std::size_t{1} << _slots_log2, {});
+        _size = items.size();
+
+        std::vector<std::vector<std::size_t>> buckets(_pilots.size());
+        for (std::size_t i = 0; i < items.size(); i++) buckets[bucket_of(items[i].first)].push_back(i);
+
+        // the largest buckets first, while most slots are free
+        std::vector<std::size_t> order(buckets.size());
+        for (std::size_t b = 0; b < order.size(); b++) order[b] = b;
+        std::stable_sort(order.begin(), order.end(), [&](auto x, auto y) { return buckets[x].size() > buckets[y].size(); });
+
+        std::vector<bool> used(_slots.size(), false);
+        std::vector<std::size_t> taken;
+        for (auto b : order) {
+            if (buckets[b].empty()) break;
+
+            std::uint32_t pilot = 0;
+            for (; pilot < max_pilot; pilot++) {
+                taken.clear();
+                for (auto i : buckets[b]) {
+                    const auto s = slot_of(items[i].first, pilot);
+                    if (used[s] || std::find(taken.begin(), taken.end(), s) != taken.end()) break;
+                    taken.push_back(s);
+                }
+                if (taken.size() == buckets[b].size()) break;
+            }
+            if (pilot == max_pilot) return false; // too crowded, retry with more slots
+
+            _pilots[b] = pilot;
+            for (std::size_t k = 0; k < taken.size(); k++) {
+                used[taken[k]] = true;
+                _slots[taken[k]] = items[buckets[b][k]];
+            }
+        }
+        return true;
+    }
+};
+
+} // namespace xp::detail
+
+#endif
@@ -0,0 +1,241 @@
+#ifndef XP_PLUGIN_H
+#define XP_PLUGIN_H
+
+#include "iid_manifest.h"
+#include "impl_intfs.h"
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#if defined(_WIN_)
+#include <windows.h>
+#else
+#include <dlfcn.h>
+#endif
+
+/**
+ * \file
+ * \brief On-demand loading of the services exported by plugin libraries
+ *
+ * A plugin library exports an entry point creating the service it publishes:
+ *
+ * \code
+ * XP_PLUGIN_ENTRY(xp_plugin_entry)
+ * {
+ *     return new Impl_Bark();
+ * }
+ * \endcode
+ *
+ * The library is only loaded when one of the IIDs it provides is first resolved from the bus:
+ *
+ * \code
+ * xp::TPluginRegistry plugins(bus_user);
+ * plugins.add({IID(IBark)}, "plugins/libbark.so");
+ * \endcode
+ *
+ * or, if the library lists them in its manifest (XP_IID_MANIFEST, see iid_manifest.h), without loading it first:
+ *
+ * \code
+ * plugins.discover("plugins/libbark.so");
+ * \endcode
+ *
+ * The library is unloaded once its entry is released, the services it exported must not be referenced
+ * after the bus is finished.
+ */
+
+#if defined(_WIN_)
+#define XP_PLUGIN_EXPORT extern "C" __declspec(dllexport)
+#else
+#define XP_PLUGIN_EXPORT extern "C" __attribute__((visibility("default")))
+#endif
+
+#define XP_PLUGIN_ENTRY(name) XP_PLUGIN_EXPORT xp::IInterfaceEx* name()
+
+namespace xp {
+
+// Exported by a plugin library: creates the service it publishes (unreferenced), nullptr if it fails.
+using plugin_entry_t = IInterfaceEx* (*)();
+
+namespace detail {
+
+// A loaded shared library, unloaded when destroyed.
+class shared_library
+{
+public:
+    explicit shared_library(const std::string& path)
+    {
+#if defined(_WIN_)
+        _handle = ::LoadLibraryA(path.c_str());
+#else
+        _handle = ::dlopen(path.c_str(), RTLD_NOW | RTLD_LOCAL);
+#endif
+    }
+    shared_library(const shared_library&) = delete;
+    shared_library& operator=(const shared_library&) = delete;
+    ~shared_library()
+    {
+        if (!_handle) return;
+#if defined(_WIN_)
+        ::FreeLibrary(static_cast<HMODULE>(_handle));
+#else
+        ::dlclose(_handle);
+#endif
+    }
+
+    bool loaded() const
+    {
+        return _handle != nullptr;
+    }
+
+    void* symbol(const std::string& name) const
+    {
+        if (!_handle) return nullptr;
+#if defined(_WIN_)
+        return reinterpret_cast<void*>(::GetProcAddress(static_cast<HMODULE>(_handle), name.c_str()));
+#else
+        return ::dlsym(_handle, name.c_str());
+#endif
+    }
+
+private:
+    void* _handle{nullptr};
+};
+
+} // namespace detail
+
+/**
+ * \class TPluginInterfaceEx
+ * \brief Connected to a bus in place of the service exported by a plugin library, loaded on its first resolution
+ *
+ * The service is finished in the slot of the entry, the library is unloaded after the service is released.
+ */
+class TPluginInterfaceEx : public TLazyInterfaceEx
+{
+public:
+    TPluginInterfaceEx(std::vector<TIntfId> iids, std::string path, std::string symbol)
+        : TPluginInterfaceEx(std::move(iids), std::make_shared<state_t>(std::move(path), std::move(symbol)))
+    {
+    }
+
+    const std::string& path() const
+    {
+        return _state->path;
+    }
+    const std::string& symbol() const
+    {
+        return _state->symbol;
+    }
+
+    // the library has been loaded
+    bool loaded() const
+    {
+        return created() != nullptr;
+    }
+    // the library failed to load, or to provide the service: it is not loaded again
+    bool failed() const
+    {
+        return _state->failed;
+    }
+
+private:
+    struct state_t {
+        std::string path;
+        std::string symbol;
+        std::unique_ptr<detail::shared_library> library{}; // set once loaded
+        std::atomic<bool> failed{false};                   // set once the load failed
+
+        state_t(std::string p, std::string s) : path(std::move(p)), symbol(std::move(s)) {}
+    };
+    std::shared_ptr<state_t> _state;
+
+    // The factory keeps the library loaded: it is destroyed after the service is released.
+    TPluginInterfaceEx(std::vector<TIntfId> iids, std::shared_ptr<state_t> state)
+        : TLazyInterfaceEx(std::move(iids), [state]() -> IInterfaceEx* { return load(*state); }), _state(std::move(state))
+    {
+    }
+
+    // single-flight (TLazyInterfaceEx)
+    static IInterfaceEx* load(state_t& state)
+    {
+        if (state.failed) return nullptr; // its iids are not resolved by the plugin any more
+
+        auto library = std::make_unique<detail::shared_library>(state.path);
+        auto entry = reinterpret_cast<plugin_entry_t>(library->symbol(state.symbol));
+        auto service = entry ? entry() : nullptr;
+        if (!service) {
+            state.failed = true;
+            return nullptr;
+        }
+        state.library = std::move(library);
+        return service;
+    }
+};
+
+/**
+ * \class TPluginRegistry
+ * \brief Plugin libraries of a bus, by the IIDs they provide
+ */
+class TPluginRegistry
+{
+public:
+    static constexpr auto default_entry = "xp_plugin_entry";
+
+    explicit TPluginRegistry(gsl::not_null<IBus*> bus) : _bus(bus.get()) {}
+
+    /**
+     * @brief Registers a plugin library, loaded on the first query of any of the iids from the bus.
+     *
+     * @param iids unique ids of the interfaces provided by the library
+     * @param path path of the library
+     * @param symbol name of its plugin_entry_t
+     * @param order finish() order of the service on the bus
+     *
+     * @return false if it cannot be connected to the bus
+     */
+    [[nodiscard]] bool add(std::vector<TIntfId> iids, std::string path, std::string symbol = default_entry, int order = 0)
+    {
+        auto_ref<TPluginInterfaceEx> plugin(new TPluginInterfaceEx(std::move(iids), std::move(path), std::move(symbol)));
+        if (!_bus->connect(plugin.get(), order)) return false;
+
+        _plugins.push_back(std::move(plugin));
+        return true;
+    }
+
+    /**
+     * @brief Registers a plugin library by the IIDs listed in its manifest, read without loading it.
+     *
+     * @return false if the library has no manifest, or cannot be connected to the bus
+     */
+    [[nodiscard]] bool discover(const std::string& path, std::string symbol = default_entry, int order = 0)
+    {
+        const auto names = read_iid_manifest(path);
+        if (!names || names->empty()) return false;
+
+        std::vector<TIntfId> iids;
+        for (const auto& name : *names) iids.push_back(calc_iid(name.c_str()));
+        return add(std::move(iids), path, std::move(symbol), order);
+    }
+
+    std::size_t size() const
+    {
+        return _plugins.size();
+    }
+
+    // number of libraries loaded so far
+    std::size_t loaded() const
+    {
+        return static_cast<std::size_t>(std::count_if(_plugins.begin(), _plugins.end(), [](auto& p) { return p->loaded(); }));
+    }
+
+private:
+    auto_ref<IBus> _bus;
+    std::vector<auto_ref<TPluginInterfaceEx>> _plugins{};
+};
+
+} // namespace xp
+
+#endif
@@ -0,0 +1,241 @@
+#ifndef XP_SHARED_VECTOR_H
+#define XP_SHARED_VECTOR_H
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <iterator>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+namespace xp::detail {
+
+/**
+ * Vector of plain values (ex: pointers, pairs of them) sharing its buffer with its copies, for the lists copied on
+ * each update of their owner (ex: the connections of a bus): a copy takes a constant time, so does an append to the
+ * last copy.
+ *
+ * A value appended to the last copy lands past the end of the other copies of the buffer, which do not see it. Any
+ * other change to a shared buffer is made to a copy of its own. The buffer is not synchronized: its copies may be
+ * read while one of them, the last one, is appended to by one thread at a time.
+ *
+ * The buffer is a single block, its header in front of the values.
+ */
+template <typename T>
+class shared_vector
+{
+    static_assert(std::is_trivially_destructible_v<T> && std::is_nothrow_copy_constructible_v<T>);
+    static_assert(alignof(T) <= alignof(std::max_align_t));
+
+public:
+    using value_type = T;
+    using const_iterator = const T*;
+    using const_reverse_iterator = std::reverse_iterator<const_iterator>;
+
+    shared_vector() = default;
+    shared_vector(const shared_vector& other) : _buffer(other._buffer), _data(other._data), _size(other._size)
+    {
+        if (_buffer) {
+            _buffer->refs.fetch_add(1, std::memory_order_relaxed);
+            _buffer->shared = true;
+        }
+    }
+    shared_vector(shared_vector&& other) noexcept
+    {
+        *this = std::move(other);
+    }
+    shared_vector& operator=(const shared_vector& other)
+    {
+        if (this != &other) *this = shared_vector(other);
+        return *this;
+    }
+    shared_vector& operator=(shared_vector&& other) noexcept
+    {
+        if (this == &other) return *this;
+        release();
+        _buffer = std::exchange(other._buffer, nullptr);
+        _data = std::exchange(other._data, nullptr);
+        _size = std::exchange(other._size, 0);
+        return *this;
+    }
+    ~shared_vector()
+    {
+        release();
+    }
+
+    template <std::input_iterator It>
+    void assign(It first, It last)
+    {
+        clear();
+        insert(end(), first, last);
+    }
+
+    const T* data() const
+    {
+        return _data;
+    }
+    std::size_t size() const
+    {
+        return _size;
+    }
+    bool empty() const
+    {
+        return _size == 0;
+    }
+
+    const_iterator begin() const
+    {
+        return _data;
+    }
+    const_iterator end() const
+    {
+        return _data + _size;
+    }
+    const_reverse_iterator rbegin() const
+    {
+        return const_reverse_iterator(end());
+    }
+    const_reverse_iterator rend() const
+    {
+        return const_reverse_iterator(begin());
+    }
+
+    const T& operator[](std::size_t i) const
+    {
+        return _data[i];
+    }
+    const T& front() const
+    {
+        return _data[0];
+    }
+    const T& back() const
+    {
+        return _data[_size - 1];
+    }
+
+    // room for n values, appended in place
+    void reserve(std::size_t n)
+    {
+        if (!appendable(n > _size ? n - _size : 0)) reallocate(std::max(n, _size), _size, 0);
+    }
+    void push_back(const T& value)
+    {
+        if (!appendable(1)) {
+            const T copy = value; // might be mine
+            reallocate(std::max(2 * _size, min_capacity), _size, 0);
+            append(copy);
+            return;
+        }
+        append(value);
+    }
+    template <typename... Args>
+    void emplace_back(Args&&... args)
+    {
+        push_back(T(std::forward<Args>(args)...));
+    }
+
+    // inserts [first, last) before pos, appended if pos is the end
+    template <std::input_iterator It>
+    void insert(const_iterator pos, It first, It last)
+    {
+        const auto i = static_cast<std::size_t>(pos - begin());
+        const auto n = static_cast<std::size_t>(std::distance(first, last));
+        open(i, n);
+        std::uninitialized_copy(first, last, _data + i);
+    }
+    void insert(const_iterator pos, std::size_t n, const T& value)
+    {
+        const T copy = value; // might be mine
+        const auto i = static_cast<std::size_t>(pos - begin());
+        open(i, n);
+        std::uninitialized_fill_n(_data + i, n, copy);
+    }
+
+    void resize(std::size_t n, const T& value = T{})
+    {
+        if (n > _size) {
+            insert(end(), n - _size, value);
+            return;
+        }
+        _size = n;
+        if (_buffer && !_buffer->shared) _buffer->used = n;
+    }
+    void clear()
+    {
+        release();
+        _buffer = nullptr;
+        _data = nullptr;
+        _size = 0;
+    }
+
+private:
+    static constexpr std::size_t min_capacity = 8;
+
+    struct alignas(std::max_align_t) buffer {
+        std::atomic<std::size_t> refs{1};
+        std::size_t capacity;
+        std::size_t used{0}; // size of the copy appended to last
+        bool shared{false};  // copied: only appended to since
+
+        explicit buffer(std::size_t n) : capacity(n) {}
+        T* values()
+        {
+            return reinterpret_cast<T*>(this + 1);
+        }
+    };
+    buffer* _buffer{nullptr};
+    T* _data{nullptr};
+    std::size_t _size{0};
+
+    void release()
+    {
+        if (_buffer && _buffer->refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            _buffer->~buffer();
+            ::operator delete(_buffer);
+        }
+    }
+
+    // whether n values can be appended in place: nothing has been appended past my end
+    bool appendable(std::size_t n) const
+    {
+        return _buffer && _buffer->used == _size && _size + n <= _buffer->capacity;
+    }
+    void append(const T& value)
+    {
+        std::construct_at(_data + _size++, value);
+        _buffer->used = _size;
+    }
+
+    // copies my values to a buffer of my own with room for capacity values, leaving room for n of them at i
+    void reallocate(std::size_t capacity, std::size_t i, std::size_t n)
+    {
+        auto b = new (::operator new(sizeof(buffer) + capacity * sizeof(T))) buffer(capacity);
+        std::uninitialized_copy(begin(), begin() + i, b->values());
+        std::uninitialized_copy(begin() + i, end(), b->values() + i + n);
+        b->used = _size;
+        release();
+        _buffer = b;
+        _data = b->values();
+    }
+
+    // room for n values at i, appended in place if i is the end
+    void open(std::size_t i, std::size_t n)
+    {
+        if (i == _size ? !appendable(n) : _buffer->shared || _size + n > _buffer->capacity) {
+            reallocate(std::max(2 * _size, std::max(_size + n, min_capacity)), i, n);
+        } else if (i < _size) {
+            // the last ones past my end, the others moved back within
+            const auto tail = std::min(n, _size - i);
+            std::uninitialized_copy(end() - tail, end(), _data + _size + n - tail);
+            std::copy_backward(begin() + i, end() - tail, _data + _size);
+        }
+        _size += n;
+        _buffer->used = _size;
+    }
+};
+
+} // namespace xp::detail
+
+#endif
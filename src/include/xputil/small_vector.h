@@ -0,0 +1,189 @@
+#ifndef XP_SMALL_VECTOR_H
+#define XP_SMALL_VECTOR_H
+
+#include <algorithm>
+#include <cstddef>
+#include <initializer_list>
+#include <iterator>
+#include <memory>
+#include <type_traits>
+#include <utility>
+
+namespace xp::detail {
+
+/**
+ * Vector of trivially copyable values, the first N of them stored in place.
+ *
+ * For the short lists copied along with their owner (ex: the buses linked to a bus): a copy is a memcpy
+ * without allocation as long as they fit in place.
+ */
+template <typename T, std::size_t N>
+class small_vector
+{
+    static_assert(std::is_trivially_copyable_v<T>);
+    static_assert(N > 0);
+
+public:
+    using value_type = T;
+    using iterator = T*;
+    using const_iterator = const T*;
+    using reverse_iterator = std::reverse_iterator<iterator>;
+    using const_reverse_iterator = std::reverse_iterator<const_iterator>;
+
+    small_vector() = default;
+    small_vector(std::initializer_list<T> values)
+    {
+        assign(values.begin(), values.end());
+    }
+    small_vector(const small_vector& other)
+    {
+        assign(other.begin(), other.end());
+    }
+    small_vector(small_vector&& other) noexcept
+    {
+        *this = std::move(other);
+    }
+    small_vector& operator=(const small_vector& other)
+    {
+        if (this != &other) assign(other.begin(), other.end());
+        return *this;
+    }
+    small_vector& operator=(small_vector&& other) noexcept
+    {
+        if (this == &other) return *this;
+        if (other._heap) {
+            _heap = std::move(other._heap);
+            _capacity = other._capacity;
+        } else {
+            _heap.reset();
+            _capacity = N;
+            std::copy(other.begin(), other.end(), _inline);
+        }
+        _size = std::exchange(other._size, 0);
+        other._capacity = N;
+        return *this;
+    }
+    ~small_vector() = default;
+
+    template <typename It>
+    void assign(It first, It last)
+    {
+        const auto n = static_cast<std::size_t>(std::distance(first, last));
+        _size = 0;
+        reserve(n);
+        std::copy(first, last, data());
+        _size = n;
+    }
+
+    T* data()
+    {
+        return _heap ? _heap.get() : _inline;
+    }
+    const T* data() const
+    {
+        return _heap ? _heap.get() : _inline;
+    }
+    std::size_t size() const
+    {
+        return _size;
+    }
+    bool empty() const
+    {
+        return _size == 0;
+    }
+    std::size_t capacity() const
+    {
+        return _capacity;
+    }
+
+    iterator begin()
+    {
+        return data();
+    }
+    iterator end()
+    {
+        return data() + _size;
+    }
+    const_iterator begin() const
+    {
+        return data();
+    }
+    const_iterator end() const
+    {
+        return data() + _size;
+    }
+    reverse_iterator rbegin()
+    {
+        return reverse_iterator(end());
+    }
+    reverse_iterator rend()
+    {
+        return reverse_iterator(begin());
+    }
+    const_reverse_iterator rbegin() const
+    {
+        return const_reverse_iterator(end());
+    }
+    const_reverse_iterator rend() const
+    {
+        return const_reverse_iterator(begin());
+    }
+
+    T& operator[](std::size_t i)
+    {
+        return data()[i];
+    }
+    const T& operator[](std::size_t i) const
+    {
+        return data()[i];
+    }
+    T& front()
+    {
+        return data()[0];
+    }
+    T& back()
+    {
+        return data()[_size - 1];
+    }
+
+    void reserve(std::size_t n)
+    {
+        if (n <= _capacity) return;
+
+        auto heap = std::make_unique_for_overwrite<T[]>(n);
+        std::copy(begin(), end(), heap.get());
+        _heap = std::move(heap);
+        _capacity = n;
+    }
+    void push_back(const T& value)
+    {
+        if (_size == _capacity) {
+            const T copy = value; // might be mine
+            reserve(2 * _capacity);
+            data()[_size++] = copy;
+            return;
+        }
+        data()[_size++] = value;
+    }
+    iterator erase(const_iterator pos)
+    {
+        const auto i = static_cast<std::size_t>(pos - begin());
+        std::copy(begin() + i + 1, end(), begin() + i);
+        _size--;
+        return begin() + i;
+    }
+    void clear()
+    {
+        _size = 0;
+    }
+
+private:
+    T _inline[N]{};
+    std::unique_ptr<T[]> _heap{}; // past N
+    std::size_t _size{0};
+    std::size_t _capacity{N};
+};
+
+} // namespace xp::detail
+
+#endif
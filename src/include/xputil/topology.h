@@ -0,0 +1,295 @@
+#ifndef XP_TOPOLOGY_H
+#define XP_TOPOLOGY_H
+
+#include "impl_intfs.h"
+#include "mapped_file.h"
+#include "plugin.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <optional>
+#include <span>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * \file
+ * \brief Binary topology manifests, to rebuild a bus graph without connecting it piece by piece
+ *
+ * \code
+ * xp::save_topology(*root, "app.topology"); // once built
+ *
+ * // next start
+ * auto buses = xp::load_topology("app.topology", [](const xp::topology_service& s) -> xp::IInterfaceEx* {
+ *     return create_service(s.iids); // nullptr: not restored (plugin services are restored as lazy entries)
+ * });
+ * xp::auto_ref<xp::TBus> root = buses[0];
+ * \endcode
+ *
+ * The manifest lists the native buses reachable from a root (levels, upper-level and sibling buses in search
+ * order), and the interfaces connected to each of them (advertised IIDs, order, priority, and the library and entry
+ * of the plugin services). It is mapped in memory and read in bulk: one copy per array, then one publication
+ * of the connections of each bus (TBus::restore()).
+ */
+
+namespace xp {
+
+// A service of a saved topology, to be created again
+struct topology_service {
+    int order;
+    int priority; // IBusEx::connectRanked()
+    std::span<const TIntfId> iids; // advertised, empty if the service does not advertise its IIDs
+    const char* origin;            // library of a plugin service, nullptr if none
+    const char* symbol;            // its plugin entry, nullptr if none
+};
+
+// Creates a service of a saved topology (unreferenced), nullptr if not restored.
+using service_factory_t = std::function<IInterfaceEx*(const topology_service&)>;
+
+namespace detail::topology_format {
+
+// Layout (native byte order and word size): header, iids[], buses[], services[], links[], strings (null-terminated)
+constexpr char signature[8] = {'x', 'p', '.', 't', 'o', 'p', 'o', '\0'};
+constexpr std::uint32_t version = 2;
+constexpr std::uint32_t no_string = ~std::uint32_t{0};
+
+struct header {
+    char magic[8];
+    std::uint32_t version;
+    std::uint32_t buses;
+    std::uint32_t services;
+    std::uint32_t iids;
+    std::uint32_t links;
+    std::uint32_t strings; // bytes
+};
+struct bus {
+    std::int32_t level;
+    std::uint32_t first_service; // services of a bus are contiguous, in connection order
+    std::uint32_t services;
+    std::uint32_t first_link; // so are its links, upper-level buses first
+    std::uint32_t uppers;
+    std::uint32_t siblings;
+};
+struct service {
+    std::int32_t order;
+    std::int32_t priority;
+    std::uint32_t first_iid;
+    std::uint32_t iids;
+    std::uint32_t origin; // string offset, no_string if none
+    std::uint32_t symbol;
+};
+using link = std::uint32_t; // index of the bus linked
+
+static_assert(sizeof(header) == 32 && sizeof(bus) == 24 && sizeof(service) == 24);
+
+} // namespace detail::topology_format
+
+/**
+ * @brief Serializes the topology of the buses reachable from root.
+ *
+ * @return the manifest, nothing if a reachable bus is not a native TBus.
+ */
+inline std::optional<std::vector<char>> export_topology(TBus& root)
+{
+    namespace fmt = detail::topology_format;
+
+    std::vector<TBus*> buses{&root};
+    std::unordered_map<IBus*, std::uint32_t> index{{&root, 0}};
+    std::vector<fmt::bus> bus_records;
+    std::vector<fmt::service> services;
+    std::vector<TIntfId> iids;
+    std::vector<fmt::link> links;
+    std::string strings;
+
+    auto add_string = [&strings](const std::string& str) {
+        const auto offset = static_cast<std::uint32_t>(strings.size());
+        strings.append(str.c_str(), str.size() + 1);
+        return offset;
+    };
+    auto add_bus = [&](IBus* bus) -> std::optional<fmt::link> {
+        if (typeid(*bus) != typeid(TBus)) return std::nullopt;
+        if (auto [it, added] = index.try_emplace(bus, static_cast<std::uint32_t>(buses.size())); !added) return it->second;
+        buses.push_back(static_cast<TBus*>(bus));
+        return static_cast<fmt::link>(buses.size() - 1);
+    };
+
+    // breadth first, in search order
+    for (std::size_t b = 0; b < buses.size(); b++) {
+        bool valid = true;
+        buses[b]->inspect([&](const auto& intfs, const auto& priorities, const auto& uppers, const auto& siblings) {
+            fmt::bus r{buses[b]->level(), static_cast<std::uint32_t>(services.size()), static_cast<std::uint32_t>(intfs.size()),
+                       static_cast<std::uint32_t>(links.size()), static_cast<std::uint32_t>(uppers.size()), static_cast<std::uint32_t>(siblings.size())};
+            bus_records.push_back(r);
+
+            for (std::size_t k = 0; k < intfs.size(); k++) {
+                const auto [order, intf] = intfs[k];
+                fmt::service s{order, priorities[k], static_cast<std::uint32_t>(iids.size()), 0, fmt::no_string, fmt::no_string};
+                std::span<const TIntfId> advertised;
+                if (detail::advertised_iids(intf, advertised)) {
+                    iids.insert(iids.end(), advertised.begin(), advertised.end());
+                    s.iids = static_cast<std::uint32_t>(advertised.size());
+                }
+                if (auto plugin = dynamic_cast<const TPluginInterfaceEx*>(intf); plugin) {
+                    s.origin = add_string(plugin->path());
+                    s.symbol = add_string(plugin->symbol());
+                }
+                services.push_back(s);
+            }
+            for (const auto* linked : {&uppers, &siblings}) {
+                for (auto bus : *linked) {
+                    const auto i = add_bus(bus);
+                    if (!i) valid = false;
+                    links.push_back(i.value_or(0));
+                }
+            }
+        });
+        if (!valid) return std::nullopt;
+    }
+
+    fmt::header h{};
+    std::memcpy(h.magic, fmt::signature, sizeof(h.magic));
+    h.version = fmt::version;
+    h.buses = static_cast<std::uint32_t>(bus_records.size());
+    h.services = static_cast<std::uint32_t>(services.size());
+    h.iids = static_cast<std::uint32_t>(iids.size());
+    h.links = static_cast<std::uint32_t>(links.size());
+    h.strings = static_cast<std::uint32_t>(strings.size());
+
+    std::vector<char> out;
+    auto append = [&out](const void* p, std::size_t size) {
+        out.insert(out.end(), static_cast<const char*>(p), static_cast<const char*>(p) + size);
+    };
+    append(&h, sizeof(h));
+    append(iids.data(), iids.size() * sizeof(TIntfId));
+    append(bus_records.data(), bus_records.size() * sizeof(fmt::bus));
+    append(services.data(), services.size() * sizeof(fmt::service));
+    append(links.data(), links.size() * sizeof(fmt::link));
+    append(strings.data(), strings.size());
+    return out;
+}
+
+// Saves the topology of the buses reachable from root to a file, false if it fails.
+inline bool save_topology(TBus& root, const std::string& path)
+{
+    const auto manifest = export_topology(root);
+    if (!manifest) return false;
+
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    file.write(manifest->data(), static_cast<std::streamsize>(manifest->size()));
+    return static_cast<bool>(file);
+}
+
+/**
+ * @brief Rebuilds the buses of a manifest, each one connected at once.
+ *
+ * Plugin services not created by the factory are connected as TPluginInterfaceEx, their libraries are
+ * only loaded when resolved.
+ *
+ * @return the buses, the root first (sibling buses are only weak-referenced by each other: keep them all alive
+ * as long as the graph is used). Empty if the manifest is not valid.
+ */
+inline std::vector<auto_ref<TBus>> import_topology(std::span<const char> manifest, const service_factory_t& factory = {})
+{
+    namespace fmt = detail::topology_format;
+
+    fmt::header h;
+    if (manifest.size() < sizeof(h)) return {};
+    std::memcpy(&h, manifest.data(), sizeof(h));
+    if (std::memcmp(h.magic, fmt::signature, sizeof(h.magic)) != 0 || h.version != fmt::version || h.buses == 0) return {};
+
+    // the arrays, not necessarily aligned
+    std::size_t offset = sizeof(h);
+    auto array = [&]<typename T>(std::uint32_t count, std::vector<T>& items) {
+        const std::uint64_t bytes = std::uint64_t{count} * sizeof(T);
+        if (manifest.size() - offset < bytes) return false;
+        if (count == 0) return true; // nothing to copy, to a null data()
+        items.resize(count);
+        std::memcpy(items.data(), manifest.data() + offset, static_cast<std::size_t>(bytes));
+        offset += static_cast<std::size_t>(bytes);
+        return true;
+    };
+    std::vector<TIntfId> iids;
+    std::vector<fmt::bus> bus_records;
+    std::vector<fmt::service> services;
+    std::vector<fmt::link> links;
+    if (!array(h.iids, iids) || !array(h.buses, bus_records) || !array(h.services, services) || !array(h.links, links)) return {};
+    if (manifest.size() - offset < h.strings || (h.strings > 0 && manifest[offset + h.strings - 1] != '\0')) return {};
+    const char* strings = manifest.data() + offset;
+
+    // validated before anything is created: the ranges of every record first, a bus refers to the links of others
+    auto in_range = [](std::uint64_t first, std::uint64_t count, std::size_t size) { return first <= size && count <= size - first; };
+    for (const auto& b : bus_records) {
+        if (!in_range(b.first_service, b.services, services.size())) return {};
+        if (!in_range(b.first_link, std::uint64_t{b.uppers} + b.siblings, links.size())) return {};
+    }
+    for (const auto& s : services) {
+        if (!in_range(s.first_iid, s.iids, iids.size())) return {};
+        if ((s.origin != fmt::no_string && s.origin >= h.strings) || (s.symbol != fmt::no_string && s.symbol >= h.strings)) return {};
+    }
+    for (const auto& b : bus_records) {
+        const auto linked = std::span<const fmt::link>(links).subspan(b.first_link, std::size_t{b.uppers} + b.siblings);
+        for (std::uint32_t i = 0; i < linked.size(); i++) {
+            if (linked[i] >= bus_records.size()) return {};
+            if (std::find(linked.begin(), linked.begin() + i, linked[i]) != linked.begin() + i) return {}; // duplicated
+
+            const auto& other = bus_records[linked[i]];
+            if (i < b.uppers) {
+                if (other.level <= b.level) return {};
+            } else {
+                // mutual, not myself
+                const auto self = static_cast<fmt::link>(&b - bus_records.data());
+                const auto back = std::span<const fmt::link>(links).subspan(std::size_t{other.first_link} + other.uppers, other.siblings);
+                if (other.level != b.level || linked[i] == self || std::find(back.begin(), back.end(), self) == back.end()) return {};
+            }
+        }
+    }
+
+    std::vector<auto_ref<TBus>> buses;
+    buses.reserve(bus_records.size());
+    for (const auto& b : bus_records) buses.emplace_back(new TBus(b.level));
+
+    for (std::size_t i = 0; i < bus_records.size(); i++) {
+        const auto& b = bus_records[i];
+
+        std::vector<std::pair<int, IInterfaceEx*>> intfs;
+        std::vector<int> priorities;
+        for (auto k = b.first_service; k < b.first_service + b.services; k++) {
+            const auto& s = services[k];
+            const topology_service service{s.order, s.priority, std::span<const TIntfId>(iids).subspan(s.first_iid, s.iids),
+                                           s.origin != fmt::no_string ? strings + s.origin : nullptr,
+                                           s.symbol != fmt::no_string ? strings + s.symbol : nullptr};
+
+            IInterfaceEx* intf = factory ? factory(service) : nullptr;
+            if (!intf && service.origin && service.symbol) {
+                intf = new TPluginInterfaceEx({service.iids.begin(), service.iids.end()}, service.origin, service.symbol);
+            }
+            if (intf) {
+                intfs.emplace_back(service.order, intf);
+                priorities.push_back(service.priority);
+            }
+        }
+
+        std::vector<IBus*> uppers, siblings;
+        for (std::uint32_t k = 0; k < b.uppers + b.siblings; k++) {
+            (k < b.uppers ? uppers : siblings).push_back(buses[links[b.first_link + k]].get());
+        }
+        buses[i]->restore(intfs, priorities, uppers, siblings);
+    }
+    return buses;
+}
+
+// Rebuilds the buses of a manifest file, see import_topology().
+inline std::vector<auto_ref<TBus>> load_topology(const std::string& path, const service_factory_t& factory = {})
+{
+    const detail::mapped_file file(path);
+    if (file.empty()) return {};
+    return import_topology(std::span<const char>(reinterpret_cast<const char*>(file.data()), file.size()), factory);
+}
+
+} // namespace xp
+
+#endif
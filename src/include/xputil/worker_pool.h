@@ -0,0 +1,162 @@
+#ifndef XP_WORKER_POOL_H
+#define XP_WORKER_POOL_H
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace xp::detail {
+
+/**
+ * Fixed number of threads running the tasks submitted, started with the pool and joined when it is destroyed.
+ *
+ * wait() is a barrier: it returns once every task submitted before has run, and rethrows the first exception
+ * thrown by one of them. The other tasks still run.
+ */
+class worker_pool
+{
+public:
+    explicit worker_pool(std::size_t workers)
+    {
+        for (std::size_t i = 0; i < workers; i++) {
+            _threads.emplace_back([this] { work(); });
+        }
+    }
+    worker_pool(const worker_pool&) = delete;
+    worker_pool& operator=(const worker_pool&) = delete;
+    ~worker_pool()
+    {
+        {
+            std::lock_guard lock(_mutex);
+            _stopping = true;
+        }
+        _ready.notify_all();
+        for (auto& t : _threads) t.join();
+    }
+
+    std::size_t size() const
+    {
+        return _threads.size();
+    }
+
+    void submit(std::function<void()> task)
+    {
+        {
+            std::lock_guard lock(_mutex);
+            _tasks.push_back(std::move(task));
+            _pending++;
+        }
+        _ready.notify_one();
+    }
+
+    void wait()
+    {
+        std::exception_ptr error;
+        {
+            std::unique_lock lock(_mutex);
+            _done.wait(lock, [this] { return _pending == 0; });
+            error = std::exchange(_error, nullptr);
+        }
+        if (error) std::rethrow_exception(error);
+    }
+
+private:
+    std::mutex _mutex;
+    std::condition_variable _ready; // a task is queued, or stopping
+    std::condition_variable _done;  // no task pending
+    std::deque<std::function<void()>> _tasks{};
+    std::size_t _pending{0}; // queued or running
+    std::exception_ptr _error{};
+    bool _stopping{false};
+    std::vector<std::thread> _threads{};
+
+    void work()
+    {
+        for (;;) {
+            std::function<void()> task;
+            {
+                std::unique_lock lock(_mutex);
+                _ready.wait(lock, [this] { return _stopping || !_tasks.empty(); });
+                if (_tasks.empty()) return;
+                task = std::move(_tasks.front());
+                _tasks.pop_front();
+            }
+
+            std::exception_ptr error;
+            try {
+                task();
+            } catch (...) {
+                error = std::current_exception();
+            }
+
+            std::lock_guard lock(_mutex);
+            if (error && !_error) _error = error;
+            if (--_pending == 0) _done.notify_all();
+        }
+    }
+};
+
+/**
+ * Runs task(i) for each i in [0, waiting.size()) once the tasks it waits for ran: waiting[i] is their number,
+ * unblocks[i] the tasks waiting for i. Among the tasks ready, the highest i runs first (the lowest one if
+ * lowest_first). On the pool if any, each task as soon as it is ready.
+ *
+ * Returns which tasks ran: not the ones left waiting in a cycle. If a task throws, the tasks waiting for it do
+ * not run, and the (first) exception is rethrown.
+ */
+template <typename F>
+std::vector<char> run_ordered(const std::vector<std::vector<std::size_t>>& unblocks, std::vector<std::size_t> waiting, bool lowest_first, F&& task,
+                              worker_pool* pool)
+{
+    const auto n = waiting.size();
+    std::vector<char> ran(n, 0);
+    auto rank = [n, lowest_first](std::size_t i) { return lowest_first ? n - 1 - i : i; }; // the highest first
+
+    if (pool) {
+        std::mutex mutex; // of ran and waiting
+        std::function<void(std::size_t)> run = [&](std::size_t i) {
+            task(i);
+
+            std::lock_guard lock(mutex);
+            ran[i] = 1;
+            for (auto next : unblocks[i]) {
+                if (--waiting[next] == 0) pool->submit([&run, next] { run(next); });
+            }
+        };
+        {
+            std::lock_guard lock(mutex);
+            for (std::size_t k = n; k-- > 0;) {
+                const auto i = rank(k);
+                if (waiting[i] == 0) pool->submit([&run, i] { run(i); });
+            }
+        }
+        pool->wait();
+        return ran;
+    }
+
+    std::priority_queue<std::size_t> ready; // by rank
+    for (std::size_t i = 0; i < n; i++) {
+        if (waiting[i] == 0) ready.push(rank(i));
+    }
+    while (!ready.empty()) {
+        const auto i = rank(ready.top());
+        ready.pop();
+        task(i);
+        ran[i] = 1;
+        for (auto next : unblocks[i]) {
+            if (--waiting[next] == 0) ready.push(rank(next));
+        }
+    }
+    return ran;
+}
+
+} // namespace xp::detail
+
+#endif
@@ -0,0 +1,212 @@
+#include <xputil/grace_period.h>
+#include <xputil/impl_intfs.h>
+
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "catch2.h"
+
+namespace {
+constexpr auto tag = "[bus-mt]";
+
+struct IStation : public xp::IInterfaceEx {
+    DECLARE_IID("0c7d1a4e-3b2f-4f4e-9a51-7e0c2d9b6f13");
+    virtual int number() const = 0;
+};
+
+// One of many stations, each resolved by its own runtime iid
+class Station : public xp::TInterfaceEx<IStation, false>, public xp::IIntfManifest
+{
+public:
+    explicit Station(int n) : _n(n), _iid(iid_of(n)) {}
+
+    static xp::TIntfId iid_of(int n)
+    {
+        return xp::calc_iid(("station." + std::to_string(n)).c_str());
+    }
+
+    int number() const override { return _n; }
+
+    xp::xp_error_code queryInterfaceEx(xp::TIntfId iid, xp::IInterface** retIntf, xp::IQueryState& qst) override
+    {
+        if (xp::equalIID(iid, _iid)) {
+            this->ref();
+            *retIntf = static_cast<IStation*>(this);
+            return xp::xp_error_code::OK;
+        }
+        return xp::TInterfaceEx<IStation, false>::queryInterfaceEx(iid, retIntf, qst);
+    }
+    bool providedIids(std::span<const xp::TIntfId>& iids) const override
+    {
+        iids = {&_iid, 1};
+        return true;
+    }
+
+private:
+    int _n;
+    xp::TIntfId _iid;
+};
+
+// does not advertise its IIDs, queries walk the graph instead of using a compiled snapshot
+struct Hidden : xp::TInterfaceEx<IStation, false> {
+    int number() const override { return -1; }
+};
+
+// number of the station resolved, -1 if none
+int resolve_station(xp::IBus* bus, int n)
+{
+    xp::IInterface* p{nullptr};
+    if (bus->queryInterface(Station::iid_of(n), &p) != xp::xp_error_code::OK) return -1;
+    const int found = static_cast<IStation*>(p)->number();
+    p->unref();
+    return found;
+}
+
+// [0,0] sibling mesh, each bus hosting a station with its own number
+struct Mesh {
+    std::vector<xp::auto_ref<xp::TBus>> buses;
+
+    Mesh(int size, bool compiled)
+    {
+        for (int i = 0; i < size; i++) {
+            buses.emplace_back(new xp::TBus(0));
+            CHECK(buses[i]->connect(new Station(i)));
+            if (!compiled) CHECK(buses[i]->connect(new Hidden()));
+        }
+        for (int i = 0; i < size; i++) {
+            for (int j = i + 1; j < size; j++) CHECK(buses[i]->connect(buses[j].get()));
+        }
+    }
+    Mesh(const Mesh&) = delete;
+    Mesh& operator=(const Mesh&) = delete;
+    ~Mesh()
+    {
+        for (auto& bus : buses) bus->finish();
+    }
+};
+
+// Every thread queries every station from every bus of the mesh.
+void query_mesh(Mesh& mesh, int threads, int rounds, std::atomic<int>& errors)
+{
+    const int size = static_cast<int>(mesh.buses.size());
+
+    std::vector<std::thread> workers;
+    for (int t = 0; t < threads; t++) {
+        workers.emplace_back([&, t] {
+            for (int r = 0; r < rounds; r++) {
+                for (int i = 0; i < size; i++) {
+                    // threads start from opposite sides of the mesh
+                    const int from = (i + t) % size;
+                    const int n = (size - i + r) % size;
+                    if (resolve_station(mesh.buses[from].get(), n) != n) errors++;
+                }
+            }
+        });
+    }
+    for (auto& w : workers) w.join();
+}
+} // namespace
+
+TEST_CASE("grace-period", tag)
+{
+    using xp::detail::grace_period;
+    grace_period a, b;
+
+    SECTION("a thread cannot wait for its own read-side section")
+    {
+        grace_period::reader reading(a);
+        CHECK_FALSE(a.synchronize());
+        CHECK(b.synchronize()); // not for the sections of another object
+
+        {
+            grace_period::reader nested(b);
+            CHECK_FALSE(b.synchronize());
+        }
+        CHECK(b.synchronize());
+    }
+    CHECK(a.synchronize());
+
+    SECTION("the sections of the other threads are waited for")
+    {
+        std::atomic<bool> entered{false}, left{false};
+        std::thread reader([&] {
+            grace_period::reader reading(a);
+            entered = true;
+            std::this_thread::sleep_for(std::chrono::milliseconds(50));
+            left = true;
+        });
+        while (!entered) std::this_thread::yield();
+
+        grace_period::reader reading(b); // in a section of another object meanwhile
+        CHECK(a.synchronize());
+        CHECK(left);
+        reader.join();
+    }
+}
+
+TEST_CASE("sibling-mesh-queries", tag)
+{
+    const int threads = static_cast<int>(std::max(2U, std::min(8U, std::thread::hardware_concurrency())));
+
+    for (bool compiled : {true, false}) {
+        Mesh mesh(8, compiled);
+        std::atomic<int> errors{0};
+
+        // opposite siblings queried concurrently: no deadlock, no wrong provider (the throughput is
+        // measured by bench/mesh_bench.cpp)
+        query_mesh(mesh, threads, 2000, errors);
+        CHECK(errors == 0);
+    }
+}
+
+TEST_CASE("sibling-mesh-topology-changes", tag)
+{
+    const int threads = static_cast<int>(std::max(2U, std::min(8U, std::thread::hardware_concurrency())));
+    constexpr int transient = 100; // number of the station connected and disconnected meanwhile
+
+    for (bool compiled : {true, false}) {
+        Mesh mesh(6, compiled);
+        const int size = static_cast<int>(mesh.buses.size());
+
+        std::atomic<bool> done{false};
+        std::atomic<int> errors{0};
+
+        std::vector<std::thread> readers;
+        for (int t = 0; t < threads; t++) {
+            readers.emplace_back([&, t] {
+                for (int r = 0; !done; r++) {
+                    auto bus = mesh.buses[(r + t) % size].get();
+                    const int n = r % size;
+                    if (resolve_station(bus, n) != n) errors++;
+
+                    // either not connected, or the right one
+                    if (const int x = resolve_station(bus, transient); x != transient && x != -1) errors++;
+                }
+            });
+        }
+
+        // the writer: stations connected and disconnected, sibling buses joining the mesh then going away
+        for (int r = 0; r < 300; r++) {
+            auto station = new Station(transient);
+            auto bus = mesh.buses[r % size].get();
+            CHECK(bus->connect(station));
+
+            {
+                xp::auto_ref<xp::TBus> joining = new xp::TBus(0);
+                CHECK(joining->connect(new Station(transient + 1 + r)));
+                CHECK(joining->connect(mesh.buses[(r + 1) % size].get()));
+                CHECK(resolve_station(mesh.buses[(r + 1) % size].get(), transient + 1 + r) == transient + 1 + r);
+                joining->finish();
+            } // destroyed while the readers may walk through it
+
+            bus->disconnect(station);
+        }
+        done = true;
+        for (auto& t : readers) t.join();
+
+        CHECK(errors == 0);
+    }
+}
@@ -0,0 +1,165 @@
+#include <xputil/iid_index.h>
+#include <xputil/shared_vector.h>
+#include <xputil/small_vector.h>
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "catch2.h"
+
+namespace {
+constexpr auto tag = "[flat_containers]";
+
+xp::TIntfId key(int i)
+{
+    return xp::calc_iid(("key." + std::to_string(i)).c_str());
+}
+} // namespace
+
+TEST_CASE("small_vector", tag)
+{
+    using v4 = xp::detail::small_vector<int, 4>;
+
+    v4 v;
+    CHECK(v.empty());
+    CHECK(v.capacity() == 4);
+
+    for (int i = 0; i < 10; i++) v.push_back(i);
+    CHECK(v.size() == 10);
+    CHECK(v.capacity() >= 10);
+    CHECK(std::vector<int>(v.begin(), v.end()) == std::vector<int>{0, 1, 2, 3, 4, 5, 6, 7, 8, 9});
+    CHECK(std::vector<int>(v.rbegin(), v.rbegin() + 2) == std::vector<int>{9, 8});
+
+    CHECK(*v.erase(v.begin() + 2) == 3);
+    CHECK(v.size() == 9);
+    v.push_back(v[0]);
+    CHECK(v.back() == 0);
+
+    // copies back in place when they fit
+    v4 small{1, 2, 3};
+    CHECK(small.capacity() == 4);
+    v4 copy = v;
+    CHECK(std::vector<int>(copy.begin(), copy.end()) == std::vector<int>(v.begin(), v.end()));
+    copy = small;
+    CHECK(std::vector<int>(copy.begin(), copy.end()) == std::vector<int>{1, 2, 3});
+
+    v4 moved = std::move(v);
+    CHECK(moved.size() == 10);
+    CHECK(v.empty());
+    moved.clear();
+    CHECK(moved.empty());
+}
+
+TEST_CASE("shared_vector", tag)
+{
+    using v = xp::detail::shared_vector<int>;
+    auto values = [](const v& x) { return std::vector<int>(x.begin(), x.end()); };
+
+    v a;
+    CHECK(a.empty());
+    for (int i = 0; i < 10; i++) a.push_back(i);
+    CHECK(a.size() == 10);
+    CHECK(values(a) == std::vector<int>{0, 1, 2, 3, 4, 5, 6, 7, 8, 9});
+
+    // appended in place by the last copy, not seen by the others
+    v b = a;
+    b.push_back(10);
+    CHECK(b.data() == a.data());
+    CHECK(a.size() == 10);
+    CHECK(b.back() == 10);
+
+    // appended to a copy of its own
+    v c = a;
+    c.push_back(-1);
+    CHECK(c.data() != a.data());
+    CHECK(values(c) == std::vector<int>{0, 1, 2, 3, 4, 5, 6, 7, 8, 9, -1});
+    CHECK(b.back() == 10);
+
+    // inserted in the middle of a copy of its own
+    v d = b;
+    const int more[] = {20, 21};
+    d.insert(d.begin() + 1, std::begin(more), std::end(more));
+    CHECK(values(d) == std::vector<int>{0, 20, 21, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10});
+    CHECK(values(b) == std::vector<int>{0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10});
+    d.insert(d.begin(), 2, d[3]);
+    CHECK(values(d) == std::vector<int>{1, 1, 0, 20, 21, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10});
+
+    // shrunk, then appended to a copy of its own
+    v e = b;
+    e.resize(2);
+    e.push_back(30);
+    CHECK(values(e) == std::vector<int>{0, 1, 30});
+    CHECK(values(b) == std::vector<int>{0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10});
+    e.resize(5, 7);
+    CHECK(values(e) == std::vector<int>{0, 1, 30, 7, 7});
+
+    v moved = std::move(b);
+    CHECK(moved.size() == 11);
+    CHECK(b.empty());
+    moved.assign(more, more + 2);
+    CHECK(values(moved) == std::vector<int>{20, 21});
+    CHECK(values(a) == std::vector<int>{0, 1, 2, 3, 4, 5, 6, 7, 8, 9});
+    moved.clear();
+    CHECK(moved.empty());
+}
+
+TEST_CASE("iid_index", tag)
+{
+    using xp::detail::iid_index;
+
+    iid_index m;
+    CHECK(m.empty());
+    CHECK(m.find(key(0)) == nullptr);
+    CHECK_FALSE(m.erase(key(0)));
+
+    // against std::map, through growth and erasures
+    std::map<xp::TIntfId, std::size_t> expected;
+    for (int i = 0; i < 5000; i++) {
+        auto [pos, inserted] = m.try_emplace(key(i), static_cast<std::size_t>(i));
+        CHECK(inserted);
+        CHECK(*pos == static_cast<std::size_t>(i));
+        expected.emplace(key(i), i);
+    }
+    CHECK_FALSE(m.try_emplace(key(7), 0).second);
+    for (int i = 0; i < 5000; i += 3) {
+        CHECK(m.erase(key(i)));
+        expected.erase(key(i));
+    }
+    CHECK_FALSE(m.erase(key(0)));
+    m.for_each([](xp::TIntfId /*iid*/, std::size_t& pos) { pos += 1; });
+    for (auto& [iid, pos] : expected) pos += 1;
+
+    CHECK(m.size() == expected.size());
+    int found = 0;
+    for (auto& [iid, pos] : expected) {
+        if (auto p = m.find(iid); p && *p == pos) found++;
+    }
+    CHECK(found == static_cast<int>(expected.size()));
+    int missing = 0;
+    for (int i = 0; i < 5000; i += 3) {
+        if (!m.find(key(i))) missing++;
+    }
+    CHECK(missing == 1667);
+
+    iid_index copy = m;
+    m.clear();
+    CHECK(m.empty());
+    CHECK(copy.size() == expected.size());
+    CHECK(*copy.find(key(1)) == 2);
+
+    // a new IID inserted in place by the last copy, any other change to a copy of its own
+    const iid_index shared = copy;
+    iid_index last = shared;
+    CHECK(last.try_emplace(key(0), 9000).second);
+    CHECK(last.size() == shared.size() + 1);
+    CHECK(*shared.find(key(0)) == 9000); // past the positions of shared
+    *last.find(key(1)) = 1;
+    CHECK(*shared.find(key(1)) == 2);
+    CHECK(last.erase(key(2)));
+    CHECK(*shared.find(key(2)) == 3);
+    iid_index other = shared; // not the last copy inserted into
+    CHECK(other.try_emplace(key(3), 9001).second);
+    CHECK(shared.find(key(3)) == nullptr);
+    CHECK(last.find(key(3)) == nullptr);
+}
@@ -0,0 +1,86 @@
+#include <xputil/iid_find.h>
+
+#include <string>
+#include <vector>
+
+#include "catch2.h"
+
+namespace {
+constexpr auto tag = "[iid_find]";
+}
+
+TEST_CASE("find_iid", tag)
+{
+    using xp::detail::find_iid;
+
+    CHECK(find_iid({}, 1) == 0);
+
+    // every position of arrays around the vector width, both in the vectorized body and the tail
+    for (std::size_t n = 1; n <= 40; n++) {
+        std::vector<xp::TIntfId> iids(n);
+        for (std::size_t i = 0; i < n; i++) iids[i] = xp::calc_iid(std::to_string(i).c_str());
+
+        for (std::size_t i = 0; i < n; i++) {
+            CHECK(find_iid(iids, iids[i]) == i);
+        }
+        CHECK(find_iid(iids, xp::calc_iid("missing")) == n);
+    }
+
+    SECTION("first occurrence")
+    {
+        std::vector<xp::TIntfId> iids(20, 7);
+        iids[13] = 5;
+        iids[17] = 5;
+        CHECK(find_iid(iids, 5) == 13);
+        CHECK(find_iid(iids, 7) == 0);
+    }
+
+    SECTION("half-matching 64 bit lanes")
+    {
+        // the low 32 bits match but not the high ones
+        const xp::TIntfId iid = 0x1234567800000001ULL;
+        std::vector<xp::TIntfId> iids(16, 0x0000000000000001ULL);
+        iids[9] = 0x1234567800000000ULL;
+        iids[11] = iid;
+        CHECK(find_iid(iids, iid) == 11);
+    }
+}
+
+TEST_CASE("iid_filter", tag)
+{
+    using xp::detail::iid_filter;
+
+    iid_filter f;
+    CHECK_FALSE(f.saturated());
+    CHECK_FALSE(f.may_contain(xp::calc_iid("any")));
+
+    // no false negatives, few false positives
+    for (int i = 0; i < 100; i++) f.add(xp::calc_iid(("in." + std::to_string(i)).c_str()));
+    int positives = 0;
+    for (int i = 0; i < 100; i++) {
+        CHECK(f.may_contain(xp::calc_iid(("in." + std::to_string(i)).c_str())));
+        if (f.may_contain(xp::calc_iid(("out." + std::to_string(i)).c_str()))) positives++;
+    }
+    CHECK(positives < 10);
+
+    SECTION("merge")
+    {
+        iid_filter g;
+        g.add(xp::calc_iid("other"));
+        CHECK_FALSE(g.may_contain(xp::calc_iid("in.0")));
+        g.merge(f);
+        CHECK(g.may_contain(xp::calc_iid("in.0")));
+        CHECK(g.may_contain(xp::calc_iid("other")));
+        CHECK_FALSE(g.saturated());
+    }
+
+    SECTION("saturation")
+    {
+        iid_filter g;
+        g.saturate();
+        CHECK(g.may_contain(xp::calc_iid("any")));
+        f.merge(g);
+        CHECK(f.saturated());
+        CHECK(f.may_contain(xp::calc_iid("any")));
+    }
+}
@@ -1,5 +1,15 @@
 #include <xputil/impl_intfs.h>
 
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <thread>
+
+#include <sys/wait.h>
+#include <unistd.h>
+
 #define CATCH_CONFIG_MAIN
 #include "catch2.h"
 
@@ -106,6 +116,62 @@ struct Foobarwoo : virtual IFoo, virtual IBar, virtual IWoo {
 };
 int Foobarwoo::count{0};
 
+struct INumbered : public xp::IInterfaceEx {
+    DECLARE_IID("a5fd3d3c-5e13-4b0e-a1f9-5f06f5f0e5a1");
+    virtual int number() const = 0;
+};
+
+// advertising its IID to the bus
+template <typename T>
+struct Advertised : xp::TInterfaceEx<T>, xp::TIntfManifest<T> {};
+
+// A service resolving a runtime-defined iid, to populate a bus with many distinct services.
+class Numbered : public xp::TInterfaceEx<INumbered, false>, public xp::IIntfManifest
+{
+public:
+    explicit Numbered(int n) : _n(n), _iid(iid_of(n)) {}
+
+    static xp::TIntfId iid_of(int n)
+    {
+        return xp::calc_iid(("numbered." + std::to_string(n)).c_str());
+    }
+
+    int number() const override { return _n; }
+
+    xp::xp_error_code queryInterfaceEx(xp::TIntfId iid, xp::IInterface** retIntf, xp::IQueryState& qst) override
+    {
+        if (xp::equalIID(iid, _iid)) {
+            this->ref();
+            *retIntf = this;
+            return xp::xp_error_code::OK;
+        }
+        qst.addSearched(this);
+        return this->searchBus(iid, retIntf, qst);
+    }
+    bool providedIids(std::span<const xp::TIntfId>& iids) const override
+    {
+        iids = {&_iid, 1};
+        return true;
+    }
+
+private:
+    int _n;
+    xp::TIntfId _iid;
+};
+
+int number_of(xp::IInterface* intf)
+{
+    return intf ? static_cast<INumbered*>(intf)->number() : -1;
+}
+
+// resolves the numbered service n from p
+int resolve_number(xp::IInterface* p, int n)
+{
+    xp::IInterface* intf{nullptr};
+    if (p->queryInterface(Numbered::iid_of(n), &intf) != xp::xp_error_code::OK) return -1;
+    xp::auto_ref<xp::IInterface> ref(intf, false);
+    return number_of(intf);
+}
 
 } // namespace
 
@@ -667,6 +733,1879 @@ TEST_CASE("bus", tag)
     CHECK(Bar::count == 0);
 }
 
+TEST_CASE("bus-traversal", tag)
+{
+    using namespace xp;
+
+    SECTION("deep cascade [0->1->...->31]")
+    {
+        // more buses than the query state keeps inline
+        std::vector<auto_ref<IBus>> buses;
+        for (int i = 0; i < 32; i++) {
+            buses.emplace_back(new TBus(i));
+            if (i > 0) CHECK(buses[i - 1]->connect(buses[i]));
+        }
+        CHECK(buses.back()->connect(new TInterfaceEx<Foo>()));
+
+        CHECK(buses.front()->supports(IID(IFoo)));
+        CHECK_FALSE(buses.front()->supports(IID(IBar)));
+        CHECK_FALSE(buses[1]->cast<IFoo>() == nullptr);
+    }
+
+    SECTION("foreign query state")
+    {
+        struct ForeignQueryState : IQueryState {
+            void addSearched(void* p) override { _searched.insert(p); }
+            bool isSearched(void* p) const override { return _searched.count(p) > 0; }
+
+            std::unordered_set<void*> _searched{};
+        };
+
+        auto_ref bus0 = new TBus(0);
+        auto_ref bus01 = new TBus(0);
+        auto_ref bus1 = new TBus(1);
+        CHECK(bus0->connect(bus01));
+        CHECK(bus01->connect(bus1));
+        CHECK(bus1->connect(new TInterfaceEx<Bar>()));
+
+        ForeignQueryState qst;
+        IInterface* p{nullptr};
+        CHECK(bus0->queryInterfaceEx(IID(IBar), &p, qst) == xp_error_code::OK);
+        auto_ref<IInterface> bar(p, false);
+        CHECK(bar);
+        CHECK(qst.isSearched(bus0.get()));
+        CHECK(qst.isSearched(bus01.get()));
+        CHECK(qst.isSearched(bus1.get()));
+
+        ForeignQueryState qst2;
+        CHECK(bus0->queryInterfaceEx(IID(IFoo), &p, qst2) == xp_error_code::INTF_NOT_RESOLVED);
+        CHECK(p == nullptr);
+    }
+
+    CHECK(Foo::count == 0);
+    CHECK(Bar::count == 0);
+}
+
+TEST_CASE("bus-route-cache", tag)
+{
+    using namespace xp;
+
+    SECTION("negative result is invalidated by connect")
+    {
+        auto_ref bus = new TBus(0);
+        CHECK_FALSE(bus->supports(IID(IFoo)));
+        CHECK_FALSE(bus->supports(IID(IFoo))); // cached miss
+
+        auto_ref foo = new TInterfaceEx<Foo>();
+        CHECK(bus->connect(foo));
+        CHECK(bus->cast<IFoo>() == foo.get());
+    }
+
+    SECTION("positive result is invalidated by disconnect")
+    {
+        auto_ref bus = new TBus(0);
+        auto_ref foo = new TInterfaceEx<Foo>();
+        CHECK(bus->connect(foo));
+        CHECK(bus->cast<IFoo>() == foo.get());
+        CHECK(bus->cast<IFoo>() == foo.get()); // cached hit
+
+        // the cache does not hold any reference
+        CHECK(foo->count() == 2);
+
+        bus->disconnect(foo);
+        CHECK_FALSE(bus->supports(IID(IFoo)));
+        CHECK(foo->count() == 1);
+    }
+
+    SECTION("changes deep in the graph are visible at the root")
+    {
+        auto_ref bus0 = new TBus(0);
+        auto_ref bus1 = new TBus(1);
+        auto_ref bus2 = new TBus(2);
+        CHECK(bus0->connect(bus1));
+        CHECK(bus1->connect(bus2));
+
+        auto_ref foo = new TInterfaceEx<Foo>();
+        CHECK(bus0->connect(foo));
+
+        CHECK_FALSE(bus0->supports(IID(IBar)));
+        CHECK_FALSE(foo->supports(IID(IBar)));
+
+        auto_ref bar = new TInterfaceEx<Bar>();
+        CHECK(bus2->connect(bar));
+        CHECK(bus0->cast<IBar>() == bar.get());
+        CHECK(foo->cast<IBar>() == bar.get());
+
+        bus2->disconnect(bar);
+        CHECK_FALSE(bus0->supports(IID(IBar)));
+        CHECK_FALSE(foo->supports(IID(IBar)));
+
+        CHECK(bus2->connect(bar));
+        CHECK(foo->cast<IBar>() == bar.get());
+        bus2->finish();
+        CHECK_FALSE(foo->supports(IID(IBar)));
+    }
+
+    SECTION("sibling changes are visible")
+    {
+        auto_ref bus0 = new TBus(0);
+        auto_ref bus01 = new TBus(0);
+        auto_ref bus1 = new TBus(1);
+        CHECK(bus0->connect(bus01));
+
+        CHECK_FALSE(bus0->supports(IID(IBar)));
+
+        auto_ref bar = new TInterfaceEx<Bar>();
+        CHECK(bus1->connect(bar));
+        CHECK(bus01->connect(bus1));
+        CHECK(bus0->cast<IBar>() == bar.get());
+
+        bus01->finish();
+        CHECK_FALSE(bus0->supports(IID(IBar)));
+    }
+
+    SECTION("the bus is visited the same way with or without a cached route")
+    {
+        auto_ref bus = new TBus(0);
+        auto_ref foo = new TInterfaceEx<Foo>();
+        CHECK(bus->connect(foo));
+
+        auto query = [&](TIntfId iid, detail::QueryState& qst) {
+            IInterface* p = nullptr;
+            const auto ec = bus->queryInterfaceEx(iid, &p, qst);
+            if (p) p->unref();
+            return ec;
+        };
+
+        for (int i = 0; i < 2; i++) { // cold, then warm cache
+            detail::QueryState hit;
+            CHECK(query(IID(IFoo), hit) == xp_error_code::OK);
+            CHECK(hit.isSearched(bus.get()));
+
+            detail::QueryState miss; // a definite miss of the reach filter
+            CHECK(query(IID(IBar), miss) != xp_error_code::OK);
+            CHECK(miss.isSearched(bus.get()));
+
+            detail::QueryState visited;
+            visited.addSearched(bus.get());
+            CHECK(query(IID(IFoo), visited) == xp_error_code::INTF_NOT_RESOLVED);
+        }
+    }
+
+    CHECK(Foo::count == 0);
+    CHECK(Bar::count == 0);
+}
+
+TEST_CASE("bus-iid-index", tag)
+{
+    using namespace xp;
+
+    // counts the queries reaching the interface
+    struct CountedBar : Advertised<Bar> {
+        xp_error_code queryInterfaceEx(TIntfId iid, IInterface** retIntf, IQueryState& qst) override
+        {
+            queries++;
+            return Advertised<Bar>::queryInterfaceEx(iid, retIntf, qst);
+        }
+        int queries{0};
+    };
+    // does not advertise its IIDs
+    struct HiddenBar : TInterfaceEx<Bar> {};
+
+    auto_ref bus = new TBus(0);
+
+    SECTION("advertised interfaces are not queried for other iids")
+    {
+        auto_ref bar = new CountedBar();
+        CHECK(bus->connect(bar));
+        auto_ref foo = new Advertised<Foo>();
+        CHECK(bus->connect(foo));
+        bar->queries = 0; // probed by connect()
+
+        CHECK(bus->cast<IFoo>() == foo.get());
+        CHECK(foo->cast<IWoo>() == nullptr);
+        CHECK(bar->queries == 0);
+
+        CHECK(foo->cast<IBar>() == bar.get());
+        CHECK(bar->queries == 1);
+    }
+
+    SECTION("a subclass answering more iids is not advertised")
+    {
+        struct IExtra : IInterface {
+            DECLARE_IID("test.IExtra");
+        };
+        // answers IExtra in its own queryInterfaceEx()
+        struct Extended : TInterfaceEx<Foo> {
+            xp_error_code queryInterfaceEx(TIntfId iid, IInterface** retIntf, IQueryState& qst) override
+            {
+                if (equalIID(iid, IID(IExtra))) {
+                    this->ref();
+                    *retIntf = this;
+                    return xp_error_code::OK;
+                }
+                return TInterfaceEx<Foo>::queryInterfaceEx(iid, retIntf, qst);
+            }
+        };
+        auto resolves_extra = [](IBus* from, IInterface* expected) {
+            IInterface* p{nullptr};
+            if (from->queryInterface(IID(IExtra), &p) != xp_error_code::OK) return false;
+            p->unref();
+            return p == expected;
+        };
+
+        auto_ref upper = new TBus(1);
+        CHECK(bus->connect(upper));
+        CHECK(bus->connect(new Advertised<Bar>()));
+        auto_ref extended = new Extended();
+        CHECK(upper->connect(extended));
+
+        CHECK(resolves_extra(upper.get(), extended.get()));
+        CHECK(resolves_extra(bus.get(), extended.get()));
+        CHECK(bus->cast<IFoo>() == extended.get());
+        bus->freeze();
+        CHECK(resolves_extra(bus.get(), extended.get()));
+        bus->thaw();
+        upper->finish();
+    }
+
+    SECTION("implementations used as they are advertise their iids")
+    {
+        auto_ref bar = new TInterfaceEx<Bar>();
+        auto_ref ranked = new TInterfaceEx<Bar>();
+        auto_ref hidden = new HiddenBar();
+        CHECK(bus->connect(bar));
+        CHECK(bus->connectRanked(ranked, 10));
+        CHECK(bus->connectRanked(hidden, 20)); // not ranked: the last connected
+        CHECK(bus->cast<IBar>() == ranked.get());
+        bus->disconnect(ranked);
+        CHECK(bus->cast<IBar>() == bar.get());
+    }
+
+    SECTION("multi-interfaces are indexed by all iids")
+    {
+        auto_ref fbw = new TMultiInterfaceEx<Foobarwoo, IFoo, IBar, IWoo>();
+        CHECK(bus->connect(fbw->first_service()));
+        CHECK(bus->supports(IID(IFoo)));
+        CHECK(bus->supports(IID(IBar)));
+        CHECK(bus->supports(IID(IWoo)));
+        CHECK_FALSE(bus->supports(IID(IBaz)));
+        bus->disconnect(fbw->first_service());
+    }
+
+    SECTION("the first connected provider wins")
+    {
+        auto_ref hidden = new HiddenBar();
+        auto_ref bar1 = new TInterfaceEx<Bar>();
+        auto_ref bar2 = new TInterfaceEx<Bar>();
+
+        CHECK(bus->connect(bar1));
+        CHECK(bus->connect(hidden));
+        CHECK(bus->connect(bar2));
+        CHECK(bus->cast<IBar>() == bar1.get());
+
+        bus->disconnect(bar1);
+        CHECK(bus->cast<IBar>() == hidden.get());
+
+        bus->disconnect(hidden);
+        CHECK(bus->cast<IBar>() == bar2.get());
+
+        CHECK(bus->connect(hidden));
+        CHECK(bus->cast<IBar>() == bar2.get());
+    }
+
+    bus->finish();
+    CHECK(Foo::count == 0);
+}
+
+TEST_CASE("bus-iid-scan", tag)
+{
+    using namespace xp;
+
+    // below and above the hash index threshold
+    for (int total : {10, 1000}) {
+        auto_ref bus = new TBus(0);
+        for (int i = 0; i < total; i++) {
+            CHECK(bus->connect(new Numbered(i)));
+        }
+        for (int i = 0; i < total; i++) {
+            CHECK(resolve_number(bus, i) == i);
+        }
+        CHECK(resolve_number(bus, total) == -1);
+
+        // duplicated iid: the first connected provider wins
+        auto_ref dup = new Numbered(total / 2);
+        CHECK(bus->connect(dup));
+        CHECK(bus->cast<INumbered>() == nullptr);
+        IInterface* p{nullptr};
+        CHECK(bus->queryInterface(Numbered::iid_of(total / 2), &p) == xp_error_code::OK);
+        CHECK(p != dup.get());
+        p->unref();
+
+        bus->finish();
+    }
+}
+
+TEST_CASE("bus-disconnect-gaps", tag)
+{
+    using namespace xp;
+
+    // does not advertise its IIDs
+    struct HiddenBar : TInterfaceEx<Bar> {};
+
+    auto numbers_of = [](IBusEx* bus, int n) {
+        auto_ref<IEnumeratorEx<IInterface*>> all(bus->queryAll(Numbered::iid_of(n)), false);
+        std::vector<int> numbers;
+        while (all->hasNext()) numbers.push_back(number_of(all->next()));
+        return numbers;
+    };
+    auto provider_of = [](IBus* bus, int n) {
+        IInterface* p{nullptr};
+        if (bus->queryInterface(Numbered::iid_of(n), &p) == xp_error_code::OK) p->unref(); // still connected
+        return p;
+    };
+
+    // below and above the hash index threshold, the disconnected interfaces skipped until compacted
+    for (int total : {10, 1000}) {
+        auto_ref bus = new TBus(0);
+        std::vector<auto_ref<Numbered>> numbered;
+        for (int i = 0; i < total; i++) {
+            numbered.emplace_back(new Numbered(i));
+            CHECK(bus->connect(numbered.back()));
+        }
+        auto_ref hidden = new HiddenBar();
+        CHECK(bus->connect(hidden));
+        auto_ref dup = new Numbered(0);
+        CHECK(bus->connect(dup));
+
+        for (int i = 0; i < total; i += 2) bus->disconnect(numbered[i]);
+        CHECK(bus->total_intfs() == static_cast<std::size_t>(total / 2 + 2));
+        int resolved = 0;
+        for (int i = 1; i < total; i++) {
+            if (resolve_number(bus, i) == (i % 2 == 1 ? i : -1)) resolved++;
+        }
+        CHECK(resolved == total - 1);
+        CHECK(resolve_number(bus, 0) == 0);
+        CHECK(numbers_of(bus, 0) == std::vector<int>{0});
+        CHECK(numbered[0]->count() == 1);
+        CHECK(bus->cast<IBar>() == hidden.get());
+
+        // connected again, after the providers left
+        CHECK(bus->connect(numbered[2]));
+        CHECK(resolve_number(bus, 2) == 2);
+        bus->disconnect(dup);
+        CHECK(resolve_number(bus, 0) == -1);
+        CHECK(bus->connect(numbered[0]));
+        CHECK(bus->connect(dup));
+        CHECK(numbers_of(bus, 0) == std::vector<int>{0, 0});
+        CHECK(provider_of(bus, 0) == numbered[0].get());
+
+        // ranked before the last connected one
+        auto_ref ranked = new Numbered(1);
+        CHECK(bus->connectRanked(ranked, 10));
+        CHECK(provider_of(bus, 1) == ranked.get());
+        bus->disconnect(ranked);
+        CHECK(provider_of(bus, 1) == numbered[1].get());
+
+        // compiled once the interface not advertising its IIDs is gone
+        bus->disconnect(hidden);
+        CHECK(bus->cast<IBar>() == nullptr);
+        bus->freeze();
+        CHECK(resolve_number(bus, total - 1) == total - 1);
+        CHECK(resolve_number(bus, 4) == -1);
+        bus->thaw();
+
+        std::size_t connected = 0;
+        bus->inspect([&](const auto& intfs, const auto& priorities, const auto&, const auto&) { connected = intfs.size() + priorities.size(); });
+        CHECK(connected == 2 * bus->total_intfs());
+
+        bus->finish();
+        for (auto& p : numbered) CHECK(p->count() == 1);
+        CHECK(hidden->count() == 1);
+    }
+}
+
+TEST_CASE("bus-miss-filter", tag)
+{
+    using namespace xp;
+
+    // root (0) <- cascade (1) <- leaf (2), leaf <-> sibling (2)
+    auto_ref root = new TBus(0);
+    auto_ref cascade = new TBus(1);
+    auto_ref leaf = new TBus(2);
+    auto_ref sibling = new TBus(2);
+    CHECK(root->connect(cascade));
+    CHECK(cascade->connect(leaf));
+    CHECK(leaf->connect(sibling));
+
+    // summaries are built by the first queries
+    CHECK_FALSE(root->supports(IID(IFoo)));
+    CHECK_FALSE(sibling->supports(IID(IFoo)));
+
+    SECTION("connections below are seen from above")
+    {
+        auto_ref foo = new TInterfaceEx<Foo>();
+        CHECK(sibling->connect(foo));
+        CHECK(root->cast<IFoo>() == foo.get());
+        CHECK(leaf->cast<IFoo>() == foo.get());
+        CHECK_FALSE(root->supports(IID(IBar)));
+
+        auto_ref bus = new TBus(3);
+        auto_ref bar = new TInterfaceEx<Bar>();
+        CHECK(bus->connect(bar));
+        CHECK(bus->supports(IID(IBar)));
+        CHECK(leaf->connect(bus));
+        CHECK(root->cast<IBar>() == bar.get());
+        CHECK(sibling->cast<IBar>() == bar.get());
+        bus->finish();
+    }
+
+    SECTION("disconnections are seen from above")
+    {
+        auto_ref foo = new TInterfaceEx<Foo>();
+        CHECK(leaf->connect(foo));
+        CHECK(root->cast<IFoo>() == foo.get());
+
+        leaf->disconnect(foo);
+        CHECK_FALSE(root->supports(IID(IFoo)));
+        CHECK_FALSE(sibling->supports(IID(IFoo)));
+
+        CHECK(sibling->connect(foo));
+        CHECK(root->cast<IFoo>() == foo.get());
+
+        sibling->finish();
+        CHECK_FALSE(root->supports(IID(IFoo)));
+        CHECK_FALSE(leaf->supports(IID(IFoo)));
+    }
+
+    SECTION("unadvertised interfaces are always searched")
+    {
+        struct HiddenBar : TInterfaceEx<Bar> {};
+        auto_ref bar = new HiddenBar();
+        CHECK(leaf->connect(bar));
+        CHECK(root->cast<IBar>() == bar.get());
+        CHECK_FALSE(root->supports(IID(IWoo)));
+    }
+
+    sibling->finish();
+    root->finish();
+    CHECK(Foo::count == 0);
+}
+
+TEST_CASE("bus-route-snapshot", tag)
+{
+    using namespace xp;
+
+    // does not advertise its IIDs, the graph cannot be compiled
+    struct HiddenBaz : TInterfaceEx<IBaz> {};
+
+    // the same results with or without a compiled snapshot
+    for (bool compiled : {true, false}) {
+        auto_ref bus0 = new TBus(0);
+        auto_ref bus01 = new TBus(0);
+        auto_ref bus1 = new TBus(1);
+        auto_ref bus2 = new TBus(2);
+        CHECK(bus0->connect(bus01));
+        CHECK(bus0->connect(bus2));
+        CHECK(bus0->connect(bus1));
+        CHECK(bus1->connect(bus2));
+
+        auto_ref baz = compiled ? new TInterfaceEx<IBaz>() : new HiddenBaz();
+        CHECK(bus2->connect(baz));
+
+        // my interfaces, then siblings, then upper-level buses
+        auto_ref foo0 = new TInterfaceEx<Foo>();
+        auto_ref foo01 = new TInterfaceEx<Foo>();
+        auto_ref foo1 = new TInterfaceEx<Foo>();
+        auto_ref bar1 = new TInterfaceEx<Bar>();
+        auto_ref bar2 = new TInterfaceEx<Bar>();
+        CHECK(bus2->connect(bar2));
+        CHECK(bus1->connect(bar1));
+        CHECK(bus1->connect(foo1));
+        CHECK(bus01->connect(foo01));
+        CHECK(bus0->connect(foo0));
+
+        CHECK(bus0->cast<IFoo>() == foo0.get());
+        CHECK(bus0->cast<IBar>() == bar1.get());
+        CHECK(bus0->cast<IBaz>() == baz.get());
+        CHECK(bus01->cast<IFoo>() == foo01.get());
+        CHECK(bus1->cast<IBar>() == bar1.get());
+        CHECK(bus2->cast<IFoo>() == nullptr);
+        CHECK_FALSE(bus0->supports(IID(IWoo)));
+
+        // rebuilt on topology changes
+        bus0->disconnect(foo0);
+        CHECK(bus0->cast<IFoo>() == foo01.get());
+        bus1->disconnect(bar1);
+        CHECK(bus0->cast<IBar>() == bar2.get());
+        CHECK(bus0->connect(bar1));
+        CHECK(bus0->cast<IBar>() == bar1.get());
+
+        // the snapshot does not hold any reference
+        CHECK(bar2->count() == 2);
+
+        bus01->finish();
+        CHECK(bus0->cast<IFoo>() == foo1.get());
+        bus0->finish();
+    }
+    CHECK(Foo::count == 0);
+    CHECK(Bar::count == 0);
+    CHECK(IBaz::count == 0);
+}
+
+TEST_CASE("bus-rcu", tag)
+{
+    using namespace xp;
+
+    // disconnects itself from the bus while being resolved
+    struct Leaving : TInterfaceEx<Foo> {
+        xp_error_code queryInterfaceEx(TIntfId iid, IInterface** retIntf, IQueryState& qst) override
+        {
+            if (auto bus = std::exchange(home, nullptr); bus) bus->disconnect(this);
+            return TInterfaceEx<Foo>::queryInterfaceEx(iid, retIntf, qst);
+        }
+        IBus* home{nullptr};
+    };
+    struct HiddenBar : TInterfaceEx<Bar> {};
+
+    // with or without a compiled snapshot
+    for (bool compiled : {true, false}) {
+        auto_ref bus = new TBus(0);
+        if (!compiled) CHECK(bus->connect(new HiddenBar()));
+
+        SECTION("connections are published to the next readers")
+        {
+            auto_ref foo = new TInterfaceEx<Foo>();
+            CHECK(bus->total_intfs() == (compiled ? 0 : 1));
+            CHECK(bus->connect(foo));
+            CHECK(bus->total_intfs() == (compiled ? 1 : 2));
+            CHECK(bus->cast<IFoo>() == foo.get());
+            bus->disconnect(foo);
+            CHECK(bus->total_intfs() == (compiled ? 0 : 1));
+            CHECK(foo->count() == 1);
+        }
+
+        SECTION("an interface disconnected by a reader is released after the read")
+        {
+            auto leaving = new Leaving();
+            CHECK(bus->connect(leaving)); // the only reference
+            leaving->home = bus.get();
+
+            IInterface* p{nullptr};
+            CHECK(bus->queryInterface(IID(IFoo), &p) == xp_error_code::OK);
+            CHECK(p == static_cast<IFoo*>(leaving));
+            CHECK(bus->total_intfs() == (compiled ? 0 : 1));
+            CHECK(Foo::count == 1);
+
+            p->unref();
+            CHECK(Foo::count == 0);
+        }
+
+        bus->finish();
+        CHECK(Foo::count == 0);
+        CHECK(Bar::count == 0);
+    }
+
+    // buses unlinked by a reader are kept alive until the read is over
+    {
+        // unlinks the buses while being searched, counts the references to the bus kept
+        struct Unlinking : TInterfaceEx<Bar> {
+            xp_error_code queryInterfaceEx(TIntfId iid, IInterface** retIntf, IQueryState& qst) override
+            {
+                for (auto& unlink : std::exchange(unlinks, {})) kept.push_back(unlink());
+                return TInterfaceEx<Bar>::queryInterfaceEx(iid, retIntf, qst);
+            }
+            std::vector<std::function<int()>> unlinks;
+            std::vector<int> kept;
+        };
+        auto_ref bus = new TBus(0);
+        auto_ref sibling = new TBus(0);
+        auto_ref upper = new TBus(1);
+        auto_ref unlinking = new Unlinking();
+        CHECK(bus->connect(sibling));
+        CHECK(bus->connect(upper));
+        CHECK(upper->connect(unlinking));
+
+        // walked from bus, then from upper: the sibling in a lookup of bus, bus (the parent) in a lookup of upper
+        unlinking->unlinks = {
+            [&] {
+                bus->removeSiblingBus(sibling.get());
+                return sibling->count();
+            },
+            [&] {
+                bus->disconnect(upper);
+                return bus->count();
+            },
+        };
+        CHECK(bus->cast<IWoo>() == nullptr);
+        CHECK(bus->total_siblings() == 0);
+        CHECK(bus->total_buses() == 0);
+        REQUIRE(unlinking->kept.size() == 2);
+        CHECK(unlinking->kept[0] == sibling->count() + 1);
+        CHECK(unlinking->kept[1] == bus->count() + 1);
+
+        upper->finish();
+        sibling->finish();
+        bus->finish();
+    }
+}
+
+TEST_CASE("bus-freeze", tag)
+{
+    using namespace xp;
+
+    struct HiddenBaz : TInterfaceEx<IBaz> {};
+
+    // root (0) <- module (1), root <-> peer (0)
+    for (bool compiled : {true, false}) {
+        auto_ref root = new TBus(0);
+        auto_ref module = new TBus(1);
+        auto_ref peer = new TBus(0);
+        CHECK(root->connect(module));
+        CHECK(root->connect(peer));
+
+        auto_ref foo = new TInterfaceEx<Foo>();
+        auto_ref bar = new TInterfaceEx<Bar>();
+        CHECK(module->connect(foo));
+        CHECK(peer->connect(bar));
+        if (!compiled) CHECK(module->connect(new HiddenBaz()));
+
+        root->freeze();
+        CHECK(root->frozen());
+        CHECK(module->frozen());
+        CHECK(peer->frozen());
+
+        CHECK(root->cast<IFoo>() == foo.get());
+        CHECK(root->cast<IBar>() == bar.get());
+        CHECK(module->cast<IBar>() == nullptr);
+        CHECK(foo->cast<IBar>() == nullptr);
+        CHECK(bar->cast<IFoo>() == foo.get());
+        CHECK_FALSE(root->supports(IID(IWoo)));
+
+        SECTION("no mutation")
+        {
+            auto_ref woo = new TInterfaceEx<Foo>();
+            CHECK_FALSE(root->connect(woo));
+            CHECK_FALSE(module->connect(woo));
+            CHECK_FALSE(peer->connect(woo));
+            CHECK_THROWS_AS(module->disconnect(foo), std::logic_error);
+
+            auto_ref other = new TBus(0);
+            CHECK_FALSE(other->connect(peer));
+            CHECK(other->total_siblings() == 0);
+
+            // frozen once
+            root->freeze();
+            root->thaw();
+            CHECK_FALSE(module->frozen());
+
+            CHECK(module->connect(woo));
+            module->disconnect(foo);
+            CHECK(root->cast<IFoo>() == woo.get());
+        }
+
+        SECTION("frozen by several buses")
+        {
+            module->freeze();
+            root->thaw();
+            CHECK(module->frozen());
+            CHECK_FALSE(root->frozen());
+            CHECK_FALSE(peer->frozen());
+            CHECK(module->cast<IFoo>() == foo.get());
+            module->thaw();
+            CHECK_FALSE(module->frozen());
+        }
+
+        SECTION("finished while frozen")
+        {
+            peer->finish();
+            CHECK(root->cast<IBar>() == nullptr);
+            CHECK(root->cast<IFoo>() == foo.get());
+        }
+
+        root->finish();
+        peer->finish();
+        CHECK(foo->count() == 1);
+        CHECK(bar->count() == 1);
+    }
+
+    // thawed during a lookup: freed by the next thaw out of one
+    {
+        // refreezes its bus when resolved
+        struct Refreezing : Advertised<IBaz> {
+            TBus* bus{nullptr};
+            xp_error_code queryInterfaceEx(TIntfId iid, IInterface** retIntf, IQueryState& qst) override
+            {
+                if (equalIID(iid, IID(IBaz))) {
+                    bus->freeze();
+                    bus->thaw();
+                }
+                return Advertised<IBaz>::queryInterfaceEx(iid, retIntf, qst);
+            }
+        };
+        // walked from a lower-level bus
+        auto_ref lower = new TBus(0);
+        auto_ref bus = new TBus(1);
+        auto_ref foo = new Advertised<Foo>();
+        auto_ref refreezing = new Refreezing();
+        refreezing->bus = bus.get();
+        struct HiddenBar : TInterfaceEx<Bar> {};
+        CHECK(lower->connect(new HiddenBar())); // not advertised
+        CHECK(lower->connect(bus));
+        CHECK(bus->connect(foo));
+        CHECK(bus->connect(refreezing));
+        CHECK(lower->cast<IBaz>() == refreezing.get()); // walking the bus
+
+        bus->disconnect(foo);
+        CHECK(foo->count() > 1); // still pinned by the frozen states
+        bus->freeze();
+        bus->thaw();
+        CHECK(foo->count() == 1);
+        lower->finish();
+    }
+    CHECK(Foo::count == 0);
+    CHECK(Bar::count == 0);
+    CHECK(IBaz::count == 0);
+}
+
+TEST_CASE("bus-batch", tag)
+{
+    using namespace xp;
+
+    struct HiddenBaz : TInterfaceEx<IBaz> {};
+    // not traversed natively
+    struct OtherBus : TBus {
+        using TBus::TBus;
+    };
+
+    // the same results as queryInterface() one at a time
+    auto check_batch = [](IBusEx* bus, const std::vector<TIntfId>& iids) {
+        std::vector<IInterface*> found(iids.size());
+        const auto total = bus->queryInterfaces(iids, found);
+
+        std::size_t resolved = 0;
+        for (std::size_t i = 0; i < iids.size(); i++) {
+            IInterface* p{nullptr};
+            if (bus->queryInterface(iids[i], &p) == xp_error_code::OK) {
+                resolved++;
+                p->unref();
+            }
+            CHECK(found[i] == p);
+            if (found[i]) found[i]->unref();
+        }
+        CHECK(total == resolved);
+    };
+
+    // root (0) <- module (1) <- other (2), root <-> peer (0)
+    for (bool compiled : {true, false}) {
+        auto_ref root = new TBus(0);
+        auto_ref peer = new TBus(0);
+        auto_ref module = new TBus(1);
+        auto_ref other = new OtherBus(2);
+        CHECK(root->connect(module));
+        CHECK(root->connect(peer));
+        CHECK(module->connect(other));
+
+        auto_ref foo0 = new TInterfaceEx<Foo>();
+        auto_ref foo1 = new TInterfaceEx<Foo>();
+        auto_ref bar = new TInterfaceEx<Bar>();
+        auto_ref fbw = new TMultiInterfaceEx<Foobarwoo, IFoo, IBar, IWoo>();
+        CHECK(module->connect(foo1));
+        CHECK(peer->connect(foo0));
+        CHECK(other->connect(fbw->first_service()));
+        CHECK(module->connect(bar));
+        if (!compiled) CHECK(other->connect(new HiddenBaz()));
+
+        const std::vector<TIntfId> iids{IID(IFoo), IID(IBar), IID(IWoo), IID(IBaz), IID(IFoo), IID_IBUSEX, IID(IDummy)};
+        check_batch(root.get(), iids);
+        check_batch(peer.get(), iids);
+        check_batch(module.get(), iids);
+        check_batch(other.get(), iids);
+        check_batch(root.get(), {});
+
+        std::vector<IInterface*> found(2);
+        CHECK(root->queryInterfaces(std::vector<TIntfId>{IID(IFoo), IID(IWoo)}, found) == 2);
+        CHECK(found[0] == static_cast<IFoo*>(foo0.get()));
+        CHECK(found[1] == fbw->first_service()->cast<IWoo>());
+        for (auto p : found) p->unref();
+
+        root->freeze();
+        check_batch(root.get(), iids);
+        root->thaw();
+
+        root->finish();
+        peer->finish();
+    }
+    CHECK(Foo::count == 0);
+    CHECK(Bar::count == 0);
+    CHECK(Foobarwoo::count == 0);
+}
+
+TEST_CASE("bus-query-all", tag)
+{
+    using namespace xp;
+
+    struct HiddenFoo : TInterfaceEx<Foo> {};
+    struct OtherBus : TBus {
+        using TBus::TBus;
+    };
+
+    auto all_foos = [](IBusEx* bus) {
+        auto_ref<IEnumeratorEx<IInterface*>> all(bus->queryAll(IID(IFoo)), false);
+        std::vector<IInterface*> foos;
+        while (all->hasNext()) foos.push_back(all->next());
+
+        CHECK(all->size() == foos.size());
+        all->rewind();
+        for (unsigned int i = 0; i < foos.size(); i++) {
+            CHECK(all->get(i) == foos[i]);
+            CHECK(all->next() == foos[i]);
+        }
+        CHECK(!all->hasNext());
+
+        // the first one is resolved by queryInterface()
+        IInterface* p{nullptr};
+        if (bus->queryInterface(IID(IFoo), &p) == xp_error_code::OK) {
+            CHECK((!foos.empty() && foos[0] == p));
+            p->unref();
+        } else {
+            CHECK(foos.empty());
+        }
+        return foos;
+    };
+    auto as_foo = [](auto& intf) { return static_cast<IInterface*>(static_cast<IFoo*>(intf.get())); };
+
+    // root (0) <- module (1) <- other (2), root <-> peer (0)
+    auto_ref root = new TBus(0);
+    auto_ref peer = new TBus(0);
+    auto_ref module = new TBus(1);
+    auto_ref other = new OtherBus(2);
+    CHECK(root->connect(module));
+    CHECK(root->connect(peer));
+    CHECK(module->connect(other));
+
+    auto_ref foo = new TInterfaceEx<Foo>();
+    auto_ref hidden = new HiddenFoo();
+    auto_ref foo0 = new TInterfaceEx<Foo>();
+    auto_ref foo1 = new TInterfaceEx<Foo>();
+    auto_ref foo2 = new TInterfaceEx<Foo>();
+    auto_ref fbw = new TMultiInterfaceEx<Foobarwoo, IFoo, IBar, IWoo>();
+    CHECK(root->connect(foo));
+    CHECK(root->connect(new TInterfaceEx<Bar>()));
+    CHECK(root->connect(hidden));
+    CHECK(peer->connect(foo0));
+    CHECK(module->connect(foo1));
+    CHECK(module->connect(fbw->first_service()));
+    CHECK(other->connect(foo2));
+
+    const std::vector<IInterface*> expected{as_foo(foo), as_foo(hidden), as_foo(foo0), as_foo(foo1), fbw->first_service()->cast<IFoo>(), as_foo(foo2)};
+    CHECK(all_foos(root.get()) == expected);
+    CHECK(all_foos(root.get()) == expected); // cached
+    CHECK(all_foos(peer.get()) == std::vector<IInterface*>{as_foo(foo0), as_foo(foo), as_foo(hidden), as_foo(foo1), fbw->first_service()->cast<IFoo>(), as_foo(foo2)});
+    CHECK(all_foos(other.get()) == std::vector<IInterface*>{as_foo(foo2)});
+
+    auto_ref<IEnumeratorEx<IInterface*>> woos(root->queryAll(IID(IWoo)), false);
+    CHECK(woos->size() == 1);
+    auto_ref<IEnumeratorEx<IInterface*>> none(root->queryAll(IID(IDummy)), false);
+    CHECK(none->size() == 0);
+    auto_ref<IEnumeratorEx<IInterface*>> buses(root->queryAll(IID_IBUS), false);
+    CHECK((buses->size() == 1 && buses->get(0) == static_cast<IInterface*>(root.get())));
+
+    // the cached providers are retired by topology changes
+    root->disconnect(foo);
+    CHECK(all_foos(root.get()) == std::vector<IInterface*>(expected.begin() + 1, expected.end()));
+    auto_ref foo3 = new TInterfaceEx<Foo>();
+    CHECK(peer->connect(foo3));
+    CHECK(all_foos(root.get()) == std::vector<IInterface*>{as_foo(hidden), as_foo(foo0), as_foo(foo3), as_foo(foo1), fbw->first_service()->cast<IFoo>(), as_foo(foo2)});
+    module->disconnect(other);
+    CHECK(all_foos(root.get()) == std::vector<IInterface*>{as_foo(hidden), as_foo(foo0), as_foo(foo3), as_foo(foo1), fbw->first_service()->cast<IFoo>()});
+
+    // an enumerator outlives the disconnection of what it lists
+    auto_ref<IEnumeratorEx<IInterface*>> all(peer->queryAll(IID(IFoo)), false);
+    peer->disconnect(foo3);
+    CHECK(all->size() == 5);
+    CHECK(static_cast<IFoo*>(all->get(1).get())->foo() == 1);
+    all = nullptr;
+    CHECK(foo3->count() == 1);
+
+    buses = nullptr;
+    root->finish();
+    peer->finish();
+    other->finish();
+}
+
+TEST_CASE("bus-lazy", tag)
+{
+    using namespace xp;
+
+    std::vector<std::string> finished;
+    struct RecordedFoo : TInterfaceEx<Foo> {
+        std::vector<std::string>& log;
+        explicit RecordedFoo(std::vector<std::string>& l) : log(l) {}
+        void onClear() override { log.push_back("foo"); }
+    };
+    struct RecordedBar : TInterfaceEx<Bar> {
+        std::vector<std::string>& log;
+        explicit RecordedBar(std::vector<std::string>& l) : log(l) {}
+        void onClear() override { log.push_back("bar"); }
+    };
+
+    std::atomic<int> built{0};
+    auto factory = [&] {
+        built++;
+        std::this_thread::sleep_for(std::chrono::milliseconds(20)); // concurrent first queries wait
+        return new RecordedFoo(finished);
+    };
+
+    {
+        auto_ref bus = new TBus(0);
+        auto_ref lazy = new TLazyInterfaceEx({IID(IFoo)}, factory);
+        CHECK(bus->connect(new RecordedBar(finished), 1));
+        CHECK(bus->connect(lazy, 0));
+
+        // not built until resolved
+        CHECK(bus->cast<IBar>() != nullptr);
+        CHECK(bus->cast<IWoo>() == nullptr);
+        CHECK(built == 0);
+        CHECK(lazy->created() == nullptr);
+
+        std::vector<IInterface*> found(8, nullptr);
+        std::vector<std::thread> threads;
+        for (auto& p : found) {
+            threads.emplace_back([&bus, &p] { (void)bus->queryInterface(IID(IFoo), &p); });
+        }
+        for (auto& t : threads) t.join();
+        CHECK(built == 1);
+        for (auto p : found) {
+            CHECK(p == static_cast<IFoo*>(static_cast<RecordedFoo*>(lazy->created())));
+            p->unref();
+        }
+
+        // hosted by the bus: the service resolves its neighbours
+        auto_ref<IBar> bar = lazy->created();
+        CHECK(bar->id() == "bar");
+        CHECK(bus->cast<IFoo>()->foo() == 1);
+        CHECK(built == 1);
+
+        // finished in its slot: pass 0 then pass 1
+        bus->finish();
+        CHECK(finished == std::vector<std::string>{"foo", "bar"});
+    }
+    CHECK(Foo::count == 0);
+    CHECK(Bar::count == 0);
+
+    // never built if not resolved
+    {
+        auto_ref bus = new TBus(0);
+        CHECK(bus->connect(new TLazyInterfaceEx({IID(IFoo)}, factory)));
+        CHECK(bus->connect(new TInterfaceEx<Bar>()));
+        CHECK(bus->cast<IBar>() != nullptr);
+        bus->finish();
+    }
+    CHECK(built == 1);
+
+    // a factory resolving what it provides does not wait for itself
+    {
+        auto_ref bus = new TBus(0);
+        auto_ref lazy = new TLazyInterfaceEx({IID(IFoo)}, [&]() -> IInterfaceEx* {
+            IInterface* p{nullptr};
+            CHECK(bus->queryInterface(IID(IFoo), &p) != xp_error_code::OK);
+            return new TInterfaceEx<Foo>();
+        });
+        CHECK(bus->connect(lazy));
+        CHECK(bus->cast<IFoo>() != nullptr);
+        bus->disconnect(lazy);
+        CHECK(lazy->created() != nullptr);
+        bus->finish();
+    }
+    CHECK(Foo::count == 0);
+
+    // factories resolving each other, first queried from two threads, do not wait for each other
+    {
+        auto_ref bus = new TBus(0);
+        std::atomic<int> entered{0};
+        std::atomic<int> resolved{0};
+        auto cross = [&](TIntfId other) {
+            entered++;
+            for (int i = 0; i < 1000 && entered < 2; i++) std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            IInterface* p{nullptr};
+            if (bus->queryInterface(other, &p) == xp_error_code::OK) {
+                resolved++;
+                p->unref();
+            }
+        };
+        CHECK(bus->connect(new TLazyInterfaceEx({IID(IFoo)}, [&] { cross(IID(IBar)); return new TInterfaceEx<Foo>(); })));
+        CHECK(bus->connect(new TLazyInterfaceEx({IID(IBar)}, [&] { cross(IID(IFoo)); return new TInterfaceEx<Bar>(); })));
+
+        std::thread other([&] { CHECK(bus->cast<IBar>() != nullptr); });
+        CHECK(bus->cast<IFoo>() != nullptr);
+        other.join();
+        CHECK(entered == 2);
+        CHECK(resolved == 1); // one of them has waited for the other
+        bus->finish();
+    }
+    CHECK(Foo::count == 0);
+    CHECK(Bar::count == 0);
+
+    // a factory failing is not called again
+    {
+        int calls = 0;
+        auto_ref bus = new TBus(0);
+        auto_ref lazy = new TLazyInterfaceEx({IID(IFoo)}, [&]() -> IInterfaceEx* { calls++; return nullptr; });
+        CHECK(bus->connect(lazy));
+        for (int i = 0; i < 3; i++) CHECK(bus->cast<IFoo>() == nullptr);
+        CHECK(calls == 1);
+        CHECK(lazy->created() == nullptr);
+        bus->finish();
+    }
+}
+
+TEST_CASE("bus-connect-many", tag)
+{
+    using namespace xp;
+
+    struct HiddenBaz : TInterfaceEx<IBaz> {};
+
+    auto_ref bus = new TBus(0);
+    auto_ref upper = new TBus(1);
+    auto_ref peer = new TBus(0);
+    auto_ref foo = new TInterfaceEx<Foo>();
+    auto_ref bar = new TInterfaceEx<Bar>();
+    auto_ref baz = new HiddenBaz();
+    CHECK(bus->connect(foo));
+
+    // already connected, duplicated, loop-back and buses
+    std::vector<IInterfaceEx*> intfs{foo.get(), bar.get(), bar.get(), baz.get(), bus.get(), upper.get(), peer.get()};
+    for (int i = 0; i < 100; i++) intfs.push_back(new Numbered(i));
+    CHECK(bus->connectMany(intfs, 1) == 104);
+    CHECK(bus->connectMany(intfs) == 0);
+    CHECK(bus->total_intfs() == 103);
+    CHECK(bus->total_buses() == 1);
+    CHECK(bus->total_siblings() == 1);
+    CHECK(bar->count() == 2);
+    CHECK(baz->count() == 2);
+
+    CHECK(bus->cast<IBar>()->bar() == 2);
+    CHECK(bus->cast<IBaz>() != nullptr);
+    for (int i = 0; i < 100; i += 7) {
+        IInterface* p{nullptr};
+        REQUIRE(bus->queryInterface(Numbered::iid_of(i), &p) == xp_error_code::OK);
+        CHECK(static_cast<INumbered*>(p)->number() == i);
+        p->unref();
+    }
+    CHECK(peer->cast<IBar>() != nullptr);
+
+    auto_ref late = new TInterfaceEx<Foo>();
+    bus->freeze();
+    CHECK(bus->connectMany(std::vector<IInterfaceEx*>{late.get()}) == 0);
+    bus->thaw();
+
+    bus->finish();
+    peer->finish();
+    CHECK(bar->count() == 1);
+    CHECK(baz->count() == 1);
+}
+
+TEST_CASE("bus-priority", tag)
+{
+    using namespace xp;
+
+    struct FastFoo : Foo {
+        int foo() const override { return 10; }
+    };
+    struct SlowFoo : Foo {
+        int foo() const override { return -1; }
+    };
+    struct HiddenFoo : TInterfaceEx<Foo> {};
+
+    auto_ref bus = new TBus(0);
+    auto_ref foo = new Advertised<Foo>();
+    auto_ref fast = new Advertised<FastFoo>();
+    auto_ref slow = new Advertised<SlowFoo>();
+    auto_ref late = new Advertised<Foo>();
+
+    SECTION("the highest priority provider wins")
+    {
+        CHECK(bus->connect(foo));
+        CHECK(bus->connectRanked(fast, 10));
+        CHECK(bus->connectRanked(slow, -1));
+        CHECK(bus->connect(late)); // same priority as foo, connected later
+        CHECK(bus->cast<IFoo>()->foo() == 10);
+        CHECK_FALSE(bus->connectRanked(fast, 20)); // already connected
+
+        auto_ref<IEnumeratorEx<IInterface*>> all(bus->queryAll(IID(IFoo)), false);
+        REQUIRE(all->size() == 4);
+        CHECK(all->get(0) == fast.get());
+        CHECK(all->get(1) == foo.get());
+        CHECK(all->get(2) == late.get());
+        CHECK(all->get(3) == slow.get());
+
+        // the fallback resolves again
+        bus->disconnect(fast);
+        CHECK(bus->cast<IFoo>() == foo.get());
+        bus->disconnect(foo);
+        CHECK(bus->cast<IFoo>() == late.get());
+        bus->disconnect(late);
+        CHECK(bus->cast<IFoo>()->foo() == -1);
+
+        CHECK(bus->connectRanked(fast, 10));
+        CHECK(bus->cast<IFoo>()->foo() == 10);
+    }
+
+    SECTION("a non-advertising interface connected first still resolves first")
+    {
+        auto_ref hidden = new HiddenFoo();
+        CHECK(bus->connect(hidden));
+        CHECK(bus->connectRanked(fast, 10));
+        CHECK(bus->cast<IFoo>() == hidden.get());
+        bus->disconnect(hidden);
+        CHECK(bus->connect(hidden));
+        CHECK(bus->cast<IFoo>()->foo() == 10);
+    }
+
+    SECTION("ranked in the hash index")
+    {
+        std::vector<IInterfaceEx*> numbered;
+        for (int i = 0; i < 100; i++) numbered.push_back(new Numbered(i));
+        CHECK(bus->connectMany(numbered) == 100);
+
+        auto provider = [&bus](int n) {
+            IInterface* p{nullptr};
+            if (bus->queryInterface(Numbered::iid_of(n), &p) == xp_error_code::OK) p->unref();
+            return p;
+        };
+        auto_ref better = new Numbered(42);
+        auto_ref worse = new Numbered(7);
+        CHECK(bus->connectRanked(better, 1));
+        CHECK(bus->connectRanked(worse, -1));
+        CHECK(provider(42) == better.get());
+        CHECK(provider(7) == numbered[7]);
+
+        bus->disconnect(numbered[7]);
+        CHECK(provider(7) == worse.get());
+        bus->disconnect(better);
+        CHECK(provider(42) == numbered[42]);
+        for (int i = 0; i < 100; i += 9) CHECK(resolve_number(bus.get(), i) == i);
+    }
+
+    SECTION("frozen")
+    {
+        CHECK(bus->connect(foo));
+        CHECK(bus->connectRanked(fast, 10));
+        bus->freeze();
+        CHECK(bus->cast<IFoo>()->foo() == 10);
+        CHECK_FALSE(bus->connectRanked(slow, 20));
+        bus->thaw();
+        CHECK(bus->connectRanked(slow, 20));
+        CHECK(bus->cast<IFoo>()->foo() == -1);
+    }
+
+    bus->finish();
+}
+
+TEST_CASE("bus-levels", tag)
+{
+    using namespace xp;
+
+    struct OtherBus : TBus {
+        using TBus::TBus;
+    };
+    auto buses_of = [](IBusEx* bus, int level) {
+        auto_ref<IEnumeratorEx<IBus*>> all(bus->findBusesByLevel(level), false);
+        std::vector<IBus*> buses;
+        while (all->hasNext()) buses.push_back(all->next());
+        CHECK((buses.empty() ? nullptr : buses[0]) == bus->findFirstBusByLevel(level));
+        return buses;
+    };
+
+    // root (0) <-> peer (0), root <- a (1) <- c (2), peer <- b (1) <- c
+    auto_ref root = new TBus(0);
+    auto_ref peer = new TBus(0);
+    auto_ref a = new TBus(1);
+    auto_ref b = new TBus(1);
+    auto_ref c = new TBus(2);
+    CHECK(root->connect(peer));
+    CHECK(root->connect(a));
+    CHECK(peer->connect(b));
+    CHECK(a->connect(c));
+    CHECK(b->connect(c));
+
+    CHECK(buses_of(root.get(), 0) == std::vector<IBus*>{root.get(), peer.get()});
+    CHECK(buses_of(root.get(), 1) == std::vector<IBus*>{a.get(), b.get()});
+    CHECK(buses_of(root.get(), 2) == std::vector<IBus*>{c.get()});
+    CHECK(buses_of(root.get(), 3).empty());
+    CHECK(buses_of(peer.get(), 1) == std::vector<IBus*>{b.get(), a.get()});
+    CHECK(buses_of(a.get(), 0).empty());
+    CHECK(buses_of(c.get(), 2) == std::vector<IBus*>{c.get()});
+
+    // updated along with the topology
+    auto_ref d = new TBus(3);
+    CHECK(c->connect(d));
+    CHECK(root->findFirstBusByLevel(3) == d.get());
+    root->disconnect(a);
+    CHECK(buses_of(root.get(), 1) == std::vector<IBus*>{b.get()});
+    CHECK(root->findFirstBusByLevel(3) == d.get());
+    peer->disconnect(b);
+    CHECK(root->findFirstBusByLevel(1) == nullptr);
+    CHECK(root->findFirstBusByLevel(3) == nullptr);
+    CHECK(root->connect(a));
+    CHECK(buses_of(root.get(), 3) == std::vector<IBus*>{d.get()});
+
+    // listed, but not searched beyond a foreign bus
+    auto_ref other = new OtherBus(1);
+    auto_ref e = new TBus(4);
+    CHECK(other->connect(e));
+    CHECK(peer->connect(other));
+    CHECK(buses_of(root.get(), 1) == std::vector<IBus*>{a.get(), other.get()});
+    auto_ref<IEnumeratorEx<IBus*>> beyond(root->findBusesByLevel(4), false);
+    CHECK(beyond->size() == 0);
+    CHECK(root->findFirstBusByLevel(4) == e.get()); // searched by the foreign bus
+    CHECK(root->findFirstBusByLevel(5) == nullptr);
+
+    for (auto bus : std::initializer_list<IBus*>{root.get(), peer.get(), a.get(), b.get(), c.get(), d.get(), other.get(), e.get()}) bus->finish();
+}
+
+TEST_CASE("bus-parallel-finish", tag)
+{
+    using namespace xp;
+
+    // finished once all of the services of its pass are being finished together (or after a while)
+    struct Draining : TInterfaceEx<Foo> {
+        Draining(std::atomic<int>& entered, int together, std::atomic<int>& done, int before)
+            : entered(entered), together(together), done(done), before(before)
+        {
+        }
+        void onClear() override
+        {
+            finished_after = done.load();
+            entered++;
+            const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+            while (entered.load() < together && std::chrono::steady_clock::now() < deadline) std::this_thread::yield();
+            met = entered.load() >= together;
+            thread = std::this_thread::get_id();
+            done++;
+        }
+        std::atomic<int>& entered;
+        const int together;
+        std::atomic<int>& done;
+        const int before;
+        int finished_after{-1};
+        bool met{false};
+        std::thread::id thread{};
+    };
+
+    SECTION("serial by default")
+    {
+        auto_ref bus = new TBus(0);
+        CHECK(bus->finishWorkers() == 0);
+        std::atomic<int> entered{0}, done{0};
+        auto_ref a = new Draining(entered, 1, done, 0);
+        auto_ref b = new Draining(entered, 1, done, 0);
+        CHECK(bus->connect(a));
+        CHECK(bus->connect(b));
+        bus->finish();
+        CHECK(b->finished_after == 0); // the last connected first
+        CHECK(a->finished_after == 1);
+        CHECK(a->thread == std::this_thread::get_id());
+    }
+
+    SECTION("concurrent within a pass, passes in order")
+    {
+        auto_ref bus = new TBus(0);
+        auto_ref upper = new TBus(1);
+        CHECK(bus->connect(upper));
+        bus->setFinishWorkers(8);
+
+        std::atomic<int> entered0{0}, entered1{0}, done{0};
+        std::vector<auto_ref<Draining>> pass0, pass1;
+        for (int i = 0; i < 4; i++) {
+            pass0.emplace_back(new Draining(entered0, 4, done, 0));
+            CHECK(bus->connect(pass0.back(), 0));
+        }
+        for (int i = 0; i < 2; i++) {
+            pass1.emplace_back(new Draining(entered1, 2, done, 4));
+            CHECK(bus->connect(pass1.back(), 1));
+        }
+        std::atomic<int> upper_entered{0};
+        auto_ref last = new Draining(upper_entered, 1, done, 6);
+        CHECK(upper->connect(last));
+
+        bus->finish();
+        for (const auto* pass : {&pass0, &pass1}) {
+            for (auto& s : *pass) {
+                CHECK(s->met);
+                CHECK(s->finished_after >= s->before);
+                CHECK(s->finished_after < s->before + static_cast<int>(pass->size()));
+                CHECK(s->thread != std::this_thread::get_id());
+            }
+        }
+        CHECK(last->finished_after == 6);
+        CHECK(upper->total_intfs() == 0);
+    }
+}
+
+namespace {
+// logs its name when finished
+struct Log {
+    std::mutex mutex;
+    std::vector<std::string> names;
+
+    void add(const std::string& name)
+    {
+        std::lock_guard lock(mutex);
+        names.push_back(name);
+    }
+    std::ptrdiff_t at(const std::string& name)
+    {
+        std::lock_guard lock(mutex);
+        return std::find(names.begin(), names.end(), name) - names.begin();
+    }
+    std::size_t size()
+    {
+        std::lock_guard lock(mutex);
+        return names.size();
+    }
+};
+// Exit status of scenario() run in a child process, -1 if it did not exit.
+template <typename F>
+int in_child_process(F&& scenario)
+{
+    const pid_t pid = fork();
+    if (pid == 0) _exit(scenario()); // no destructor, exit handler nor leak report
+    int status = 0;
+    if (pid < 0 || waitpid(pid, &status, 0) != pid || !WIFEXITED(status)) return -1;
+    return WEXITSTATUS(status);
+}
+
+template <typename T>
+struct Logged : xp::TInterfaceEx<T> {
+    Logged(Log& log, std::string name) : log(log), name(std::move(name)) {}
+    void onClear() override
+    {
+        log.add(name);
+    }
+    Log& log;
+    const std::string name;
+};
+} // namespace
+
+TEST_CASE("bus-dependency-finish", tag)
+{
+    using namespace xp;
+
+    Log log;
+
+    SECTION("any order")
+    {
+        auto_ref bus = new TBus(0);
+        CHECK(bus->finishOrder() == TBus::finish_order::passes);
+        CHECK(bus->connect(new Logged<Foo>(log, "5"), 5));
+        CHECK(bus->connect(new Logged<Bar>(log, "-1"), -1));
+        CHECK(bus->connect(new Logged<IBaz>(log, "3"), 3));
+        bus->finish();
+        CHECK(log.names == std::vector<std::string>{"-1", "3", "5"});
+    }
+
+    SECTION("observed and declared")
+    {
+        auto_ref bus = new TBus(0);
+        bus->setFinishOrder(TBus::finish_order::dependencies);
+        auto_ref foo = new Logged<Foo>(log, "foo");
+        auto_ref bar = new Logged<Bar>(log, "bar");
+        auto_ref baz = new Logged<IBaz>(log, "baz");
+        CHECK(bus->connect(foo, 2)); // the order is ignored
+        CHECK(bus->connect(bar, 1));
+        CHECK(bus->connect(baz, 0));
+
+        CHECK(foo->supports(IBar::iid())); // foo uses bar
+        CHECK(bar->supports(IBaz::iid())); // bar uses baz
+        bus->addDependency(baz, foo);      // ... which cannot go without foo
+        bus->addDependency(bar, foo);      // cycle
+        bus->finish();
+
+        // baz is in the cycle, the last connected of them first
+        CHECK(log.names == std::vector<std::string>{"baz", "bar", "foo"});
+    }
+
+    SECTION("dependents first")
+    {
+        auto_ref bus = new TBus(0);
+        bus->setFinishOrder(TBus::finish_order::dependencies);
+        auto_ref foo = new Logged<Foo>(log, "foo");
+        auto_ref bar = new Logged<Bar>(log, "bar");
+        auto_ref baz = new Logged<IBaz>(log, "baz");
+        CHECK(bus->connect(baz));
+        CHECK(bus->connect(foo));
+        CHECK(bus->connect(bar));
+
+        CHECK(bus->supports(IBar::iid())); // cached route
+        CHECK(foo->supports(IBar::iid()));
+        CHECK(bar->supports(IBaz::iid()));
+        bus->finish();
+        CHECK(log.names == std::vector<std::string>{"foo", "bar", "baz"});
+    }
+
+    SECTION("dependencies through a frozen bus")
+    {
+        auto_ref bus = new TBus(0);
+        bus->setFinishOrder(TBus::finish_order::dependencies);
+        auto_ref foo = new Logged<Foo>(log, "foo");
+        auto_ref bar = new Logged<Bar>(log, "bar");
+        CHECK(bus->connect(bar));
+        CHECK(bus->connect(foo));
+        bus->freeze();
+        CHECK(bar->supports(IFoo::iid()));
+        bus->finish();
+        CHECK(log.names == std::vector<std::string>{"bar", "foo"});
+    }
+
+    SECTION("not observed in pass order")
+    {
+        auto_ref bus = new TBus(0);
+        auto_ref foo = new Logged<Foo>(log, "foo");
+        auto_ref bar = new Logged<Bar>(log, "bar");
+        CHECK(bus->connect(bar));
+        CHECK(bus->connect(foo));
+        CHECK(bar->supports(IFoo::iid()));
+        bus->setFinishOrder(TBus::finish_order::dependencies);
+        bus->finish();
+        CHECK(log.names == std::vector<std::string>{"foo", "bar"});
+    }
+
+    SECTION("concurrently")
+    {
+        auto_ref bus = new TBus(0);
+        bus->setFinishOrder(TBus::finish_order::dependencies);
+        bus->setFinishWorkers(4);
+
+        // chains of three, the first one depending on the second one and so on
+        std::vector<auto_ref<IInterfaceEx>> services;
+        for (int chain = 0; chain < 8; chain++) {
+            for (int link = 0; link < 3; link++) {
+                services.emplace_back(new Logged<Foo>(log, std::to_string(chain) + "." + std::to_string(link)));
+                CHECK(bus->connect(services.back()));
+            }
+            const auto first = services.end() - 3;
+            bus->addDependency(first[0], first[1]);
+            bus->addDependency(first[1], first[2]);
+        }
+        bus->finish();
+
+        REQUIRE(log.names.size() == services.size());
+        for (int chain = 0; chain < 8; chain++) {
+            const auto name = std::to_string(chain) + ".";
+            CHECK(log.at(name + "0") < log.at(name + "1"));
+            CHECK(log.at(name + "1") < log.at(name + "2"));
+        }
+    }
+}
+
+TEST_CASE("bus-fast-exit", tag)
+{
+    using namespace xp;
+
+    // not released at exit: of their own kind, not counted
+    struct IJournal : IInterfaceEx {
+        DECLARE_IID("test.IJournal");
+    };
+    // with something to flush at exit
+    struct Flushing : Logged<IJournal>, IExitCritical {
+        Flushing(Log& log, std::string name, bool pending = true) : Logged<IJournal>(log, std::move(name)), pending(pending) {}
+        bool finishAtExit() const override
+        {
+            return pending;
+        }
+        const bool pending;
+    };
+
+    // The graph is left to the OS: in a child process, exiting without any teardown. Returns the first check failed.
+    const int failed = in_child_process([] {
+        Log log;
+        auto_ref root = new TBus(0);
+        auto_ref sibling = new TBus(0);
+        auto upper = new TBus(1);
+        if (!root->connect(sibling) || !root->connect(upper) || !sibling->connect(upper)) return 1;
+
+        // forwarded to the service of a lazy interface, once created
+        auto_ref lazy = new TLazyInterfaceEx({IID(IJournal)}, [&] { return new Flushing(log, "lazy"); });
+        if (!root->connect(lazy, 2) || !root->connect(new TLazyInterfaceEx({IID(IJournal)}, [&] { return new Flushing(log, "idle"); }), 2)) return 1;
+        if (auto_ref<IJournal> journal = lazy.get(); !journal) return 1;
+
+        if (!root->connect(new Flushing(log, "root.1"), 1) || !root->connect(new Logged<IJournal>(log, "root.plain")) ||
+            !root->connect(new Flushing(log, "root.0")) || !root->connect(new Flushing(log, "root.clean", false)) ||
+            !sibling->connect(new Flushing(log, "sibling")) || !upper->connect(new Flushing(log, "upper")) ||
+            !upper->connect(new Logged<IJournal>(log, "upper.plain")))
+            return 2;
+
+        // the upper-level buses are abandoned too, not the siblings (not owned)
+        root->fastExit();
+        if (log.names != std::vector<std::string>{"root.0", "root.1", "lazy", "upper"}) return 3;
+        if (root->total_intfs() != 6 || upper->total_intfs() != 2) return 4; // still connected
+        if (sibling->total_intfs() != 1) return 5;
+
+        sibling->fastExit();
+        root->finish(); // already
+        if (log.names != std::vector<std::string>{"root.0", "root.1", "lazy", "upper", "sibling"}) return 6;
+        return 0;
+    });
+    CHECK(failed == 0);
+
+    // the siblings outliving an abandoned bus no longer reach it
+    const int outlived = in_child_process([] {
+        auto_ref finished = new TBus(0);
+        auto_ref released = new TBus(0);
+        {
+            auto_ref root = new TBus(0);
+            if (!root->connect(finished) || !root->connect(released)) return 1;
+            root->fastExit();
+            if (root->total_siblings() != 0 || finished->total_siblings() != 0 || released->total_siblings() != 0) return 2;
+
+            finished->finish(); // the abandoned bus is not unlinked again
+        }
+        // released first
+        if (released->cast<IFoo>() != nullptr) return 3;
+        released->finish();
+        return 0;
+    });
+    CHECK(outlived == 0);
+}
+
+namespace {
+// logs its name when started, after the ones it needs
+template <typename T>
+struct Starting : Logged<T>, xp::IStartable {
+    Starting(Log& started, Log& finished, std::string name, std::vector<xp::TIntfId> needs = {})
+        : Logged<T>(finished, name), started(started), needs(std::move(needs))
+    {
+    }
+    std::span<const xp::TIntfId> startDependencies() const override
+    {
+        return needs;
+    }
+    void start() override
+    {
+        if (fails) throw std::runtime_error("start failed");
+        if (meet) {
+            // until the other one is starting as well (or after a while)
+            (*meet)++;
+            const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+            while (meet->load() < 2 && std::chrono::steady_clock::now() < deadline) std::this_thread::yield();
+            met = meet->load() >= 2;
+        }
+        started.add(this->name);
+    }
+    Log& started;
+    const std::vector<xp::TIntfId> needs;
+    bool fails{false};
+    std::atomic<int>* meet{nullptr};
+    bool met{false};
+};
+} // namespace
+
+TEST_CASE("bus-start", tag)
+{
+    using namespace xp;
+
+    struct IQux : IInterfaceEx {
+        DECLARE_IID("test.IQux");
+    };
+    struct IMissing : IInterfaceEx {
+        DECLARE_IID("test.IMissing");
+    };
+
+    Log started, finished;
+    auto_ref bus = new TBus(0);
+    auto_ref web = new Starting<Foo>(started, finished, "web", {IBar::iid(), IBaz::iid()});
+    auto_ref cache = new Starting<Bar>(started, finished, "cache", {IBaz::iid(), IMissing::iid()}); // not started by the bus
+    auto_ref db = new Starting<IBaz>(started, finished, "db");
+    auto_ref log = new Starting<IQux>(started, finished, "log");
+    CHECK(bus->connect(web));
+    CHECK(bus->connect(cache));
+    CHECK(bus->connect(db));
+    CHECK(bus->connect(log));
+
+    SECTION("in dependency order")
+    {
+        auto_ref upper = new TBus(1);
+        CHECK(bus->connect(upper));
+        CHECK(upper->connect(new Starting<IQux>(started, finished, "upper")));
+        CHECK(bus->connect(new TInterfaceEx<IMissing>()));
+
+        bus->start();
+        CHECK(started.names == std::vector<std::string>{"upper", "db", "cache", "web", "log"});
+        bus->start(); // once
+        CHECK(started.names.size() == 5);
+
+        auto_ref late = new Starting<IQux>(started, finished, "late", {IFoo::iid()});
+        CHECK(bus->connect(late));
+        bus->start();
+        CHECK(started.names.back() == "late");
+
+        // finished before what they needed to start
+        bus->setFinishOrder(TBus::finish_order::dependencies);
+        bus->finish();
+        CHECK(finished.at("web") < finished.at("cache"));
+        CHECK(finished.at("cache") < finished.at("db"));
+        CHECK(finished.at("late") < finished.at("web"));
+        CHECK(finished.names.back() == "upper");
+    }
+
+    SECTION("the service of a lazy interface, once created")
+    {
+        auto_ref other = new TBus(0);
+        other->setFinishOrder(TBus::finish_order::dependencies);
+        auto_ref lazy = new TLazyInterfaceEx({IQux::iid()}, [&] { return new Starting<IQux>(started, finished, "lazy"); });
+        CHECK(other->connect(lazy));
+        CHECK(other->connect(new Logged<Bar>(finished, "bar"))); // the last connected, finished first if independent
+
+        other->start();
+        CHECK(started.names.empty());
+        CHECK(lazy->created() == nullptr);
+
+        CHECK(other->cast<IQux>() != nullptr);
+        other->start();
+        CHECK(started.names == std::vector<std::string>{"lazy"});
+
+        // the service uses bar: the lazy interface is finished first
+        CHECK(lazy->created()->supports(IBar::iid()));
+        other->finish();
+        CHECK(finished.names == std::vector<std::string>{"lazy", "bar"});
+    }
+
+    SECTION("the service of a lazy interface, created as a dependency")
+    {
+        auto_ref other = new TBus(0);
+        auto_ref lazy = new TLazyInterfaceEx({IQux::iid()}, [&] { return new Starting<IQux>(started, finished, "lazy", {IBar::iid()}); });
+        CHECK(other->connect(lazy));
+        CHECK(other->connect(new Starting<Foo>(started, finished, "needs", {IQux::iid()})));
+        CHECK(other->connect(new Starting<Bar>(started, finished, "bar")));
+
+        // created by the resolution of the dependencies, started before the ones needing it
+        CHECK(other->start().empty());
+        CHECK(lazy->created() != nullptr);
+        CHECK(started.names == std::vector<std::string>{"bar", "lazy", "needs"});
+        other->start();
+        CHECK(started.names.size() == 3);
+        other->finish();
+    }
+
+    SECTION("concurrently")
+    {
+        std::atomic<int> meet{0};
+        db->meet = &meet; // independent of each other
+        log->meet = &meet;
+
+        bus->start(4);
+        CHECK(db->met);
+        CHECK(log->met);
+        CHECK(started.at("db") < started.at("cache"));
+        CHECK(started.at("cache") < started.at("web"));
+        CHECK(started.names.size() == 4);
+    }
+
+    SECTION("cycle")
+    {
+        struct IA : IInterfaceEx {
+            DECLARE_IID("test.IA");
+        };
+        struct IB : IInterfaceEx {
+            DECLARE_IID("test.IB");
+        };
+        struct IC : IInterfaceEx {
+            DECLARE_IID("test.IC");
+        };
+        auto_ref a = new Starting<IA>(started, finished, "a", {IB::iid(), IA::iid()});
+        auto_ref b = new Starting<IB>(started, finished, "b", {IA::iid()});
+        auto_ref c = new Starting<IC>(started, finished, "c", {IB::iid()}); // not in the cycle, waiting for it
+        CHECK(bus->connect(c));
+        CHECK(bus->connect(a));
+        CHECK(bus->connect(b));
+        bus->addDependency(db, a); // not for the start
+
+        // broken by starting the first connected of the cycle, reported
+        CHECK(bus->start() == std::vector<IInterfaceEx*>{a.get()});
+        CHECK(started.names == std::vector<std::string>{"db", "cache", "web", "log", "a", "b", "c"});
+        CHECK(bus->start().empty());
+    }
+
+    SECTION("failure")
+    {
+        cache->fails = true;
+        CHECK_THROWS_AS(bus->start(), std::runtime_error);
+        CHECK(started.names == std::vector<std::string>{"db"});
+
+        cache->fails = false;
+        bus->start();
+        CHECK(started.names == std::vector<std::string>{"db", "cache", "web", "log"});
+    }
+}
+
+TEST_CASE("bus-async-finish", tag)
+{
+    using namespace xp;
+    using namespace std::chrono_literals;
+
+    // drained when the test says so
+    struct Draining : Logged<IBaz>, IAsyncFinish {
+        using Logged<IBaz>::Logged;
+        std::future<void> finishAsync() override
+        {
+            if (finished()) return {};
+            finish();
+            return drained.get_future();
+        }
+        std::promise<void> drained;
+    };
+
+    Log log;
+    auto_ref bus = new TBus(0);
+    auto_ref a = new Draining(log, "a");
+    auto_ref b = new Draining(log, "b");
+    auto_ref c = new Logged<IBaz>(log, "c");
+    CHECK(bus->connect(a));
+    CHECK(bus->connect(b));
+    CHECK(bus->connect(c, 1));
+    CHECK(bus->finishTimeout() == 0ms);
+
+    SECTION("drains of a pass awaited together")
+    {
+        // in reverse, as soon as both are being drained
+        std::thread drain([&] {
+            while (log.size() < 2) std::this_thread::yield();
+            a->drained.set_value();
+            std::this_thread::sleep_for(10ms);
+            b->drained.set_value();
+        });
+        bus->finish();
+        drain.join();
+        CHECK(log.names == std::vector<std::string>{"b", "a", "c"});
+        CHECK(bus->stragglers().empty());
+    }
+
+    SECTION("stragglers")
+    {
+        bus->setFinishTimeout(20ms);
+        a->drained.set_value();
+        const auto start = std::chrono::steady_clock::now();
+        bus->finish();
+        CHECK(std::chrono::steady_clock::now() - start < 5s);
+        CHECK(log.names == std::vector<std::string>{"b", "a", "c"});
+
+        auto late = bus->stragglers();
+        REQUIRE(late.size() == 1);
+        CHECK(late[0].intf.get() == static_cast<IInterfaceEx*>(b.get()));
+        CHECK(late[0].done.wait_for(0s) == std::future_status::timeout);
+        b->drained.set_value();
+        late[0].done.get();
+        CHECK(bus->stragglers().empty());
+    }
+
+    SECTION("stragglers left to their drain by the destruction of the bus")
+    {
+        auto_ref d = new Draining(log, "d");
+        const auto start = std::chrono::steady_clock::now();
+        {
+            auto_ref other = new TBus(0);
+            CHECK(other->connect(d));
+            other->setFinishTimeout(10ms);
+            other->finish();
+        }
+        CHECK(std::chrono::steady_clock::now() - start < 5s);
+        CHECK(d->count() == 2); // kept alive until drained
+
+        d->drained.set_value();
+        while (d->count() > 1 && std::chrono::steady_clock::now() - start < 5s) std::this_thread::yield();
+        CHECK(d->count() == 1);
+
+        a->drained.set_value();
+        b->drained.set_value();
+        bus->finish();
+    }
+
+    SECTION("stragglers awaited at exit up to the timeout")
+    {
+        a->drained.set_value();
+        b->drained.set_value();
+        bus->finish();
+
+        const int status = in_child_process([] {
+            Log log;
+            auto never = new Draining(log, "never");
+            {
+                auto_ref other = new TBus(0);
+                if (!other->connect(never)) return 1;
+                other->setFinishTimeout(20ms);
+                other->finish();
+            }
+            std::exit(0); // not held by its drain
+        });
+        CHECK(status == 0);
+    }
+
+    SECTION("forwarded by a lazy interface")
+    {
+        auto_ref other = new TBus(0);
+        auto_ref lazy = new TLazyInterfaceEx({IID(IBaz)}, [&] { return new Draining(log, "lazy"); });
+        CHECK(other->connect(lazy));
+        CHECK(other->cast<IBaz>() != nullptr);
+        other->setFinishTimeout(10ms);
+        other->finish();
+        CHECK(log.names == std::vector<std::string>{"lazy"});
+
+        auto late = other->stragglers(); // the drain of the service
+        REQUIRE(late.size() == 1);
+        CHECK(late[0].intf.get() == static_cast<IInterfaceEx*>(lazy.get()));
+        static_cast<Draining*>(lazy->created())->drained.set_value();
+        late[0].done.get();
+
+        a->drained.set_value();
+        b->drained.set_value();
+        bus->finish();
+    }
+
+    SECTION("failed drain")
+    {
+        a->drained.set_value();
+        b->drained.set_exception(std::make_exception_ptr(std::runtime_error("lost")));
+        CHECK_THROWS_AS(bus->finish(), std::runtime_error);
+    }
+
+    SECTION("in dependency order")
+    {
+        bus->setFinishOrder(TBus::finish_order::dependencies);
+        bus->setFinishWorkers(4);
+        bus->addDependency(a, b);
+        bool waited{false};
+        std::thread drain([&] {
+            while (log.size() < 2) std::this_thread::yield(); // c and a
+            std::this_thread::sleep_for(10ms);
+            waited = log.size() == 2; // b waits for the drain of a
+            a->drained.set_value();
+            b->drained.set_value();
+        });
+        bus->finish();
+        drain.join();
+        CHECK(waited);
+        CHECK(log.at("a") < log.at("b"));
+    }
+
+    SECTION("independent drains awaited together in dependency order")
+    {
+        bus->setFinishOrder(TBus::finish_order::dependencies); // without workers
+        bool together{false};
+        std::thread drain([&] {
+            const auto timeout = std::chrono::steady_clock::now() + 5s;
+            while (log.size() < 3 && std::chrono::steady_clock::now() < timeout) std::this_thread::yield();
+            together = log.size() == 3; // neither drain awaited before the other one started
+            a->drained.set_value();
+            b->drained.set_value();
+        });
+        bus->finish();
+        drain.join();
+        CHECK(together);
+    }
+}
+
 TEST_CASE("ref-issue", tag)
 {
     using namespace xp;
@@ -0,0 +1,51 @@
+#include <xputil/perfect_hash.h>
+
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "catch2.h"
+
+namespace {
+constexpr auto tag = "[perfect_hash]";
+
+xp::TIntfId key(int i)
+{
+    return xp::calc_iid(("key." + std::to_string(i)).c_str());
+}
+} // namespace
+
+TEST_CASE("perfect_hash_map", tag)
+{
+    using xp::detail::perfect_hash_map;
+
+    SECTION("empty")
+    {
+        perfect_hash_map<int> m;
+        CHECK(m.size() == 0);
+        CHECK(m.find(key(0)) == nullptr);
+
+        perfect_hash_map<int> n(std::vector<std::pair<xp::TIntfId, int>>{});
+        CHECK(n.find(key(0)) == nullptr);
+    }
+
+    for (int total : {1, 2, 3, 5, 17, 100, 1000, 10000}) {
+        std::vector<std::pair<xp::TIntfId, int>> items;
+        for (int i = 0; i < total; i++) items.emplace_back(key(i), i + 1);
+
+        perfect_hash_map<int> m(items);
+        CHECK(m.size() == static_cast<std::size_t>(total));
+
+        int found = 0;
+        for (int i = 0; i < total; i++) {
+            if (auto p = m.find(key(i)); p && *p == i + 1) found++;
+        }
+        CHECK(found == total);
+
+        int missing = 0;
+        for (int i = total; i < 2 * total; i++) {
+            if (!m.find(key(i))) missing++;
+        }
+        CHECK(missing == total);
+    }
+}
@@ -0,0 +1,104 @@
+#include <xputil/plugin.h>
+
+#include "catch2.h"
+#include "plugins/greeter.h"
+
+namespace {
+constexpr auto tag = "[plugin]";
+
+struct IMissing : public xp::IInterfaceEx {
+    DECLARE_IID("plugin.missing");
+};
+
+struct Greeting : IGreeting {
+    int value() const override { return 42; }
+};
+} // namespace
+
+TEST_CASE("plugin-registry", tag)
+{
+    using namespace xp;
+
+    auto_ref bus = new TBus(0);
+    CHECK(bus->connect(new TInterfaceEx<Greeting>()));
+
+    TPluginRegistry plugins(bus.get());
+    CHECK(plugins.add({IID(IGreeter)}, XP_TEST_PLUGIN));
+    CHECK(plugins.add({IID(IMissing)}, XP_TEST_PLUGIN, "xp_plugin_failure"));
+    CHECK(plugins.add({IID(IMissing)}, "no-such-plugin"));
+    CHECK(plugins.size() == 3);
+
+    // not loaded by the queries of other interfaces
+    CHECK(bus->cast<IGreeting>() != nullptr);
+    CHECK(plugins.loaded() == 0);
+
+    // loaded once, hosted by the bus
+    for (int i = 0; i < 2; i++) {
+        auto_ref<IGreeter> greeter = bus.get();
+        REQUIRE(greeter);
+        CHECK(greeter->greet() == 42);
+    }
+    CHECK(plugins.loaded() == 1);
+
+    // neither a missing library nor a failing entry resolves
+    CHECK(bus->cast<IMissing>() == nullptr);
+    CHECK(plugins.loaded() == 1);
+
+    bus->finish();
+}
+
+TEST_CASE("plugin-failure", tag)
+{
+    using namespace xp;
+
+    auto_ref bus = new TBus(0);
+    auto_ref missing = new TPluginInterfaceEx({IID(IMissing)}, "no-such-plugin", TPluginRegistry::default_entry);
+    auto_ref failing = new TPluginInterfaceEx({IID(IMissing)}, XP_TEST_PLUGIN, "xp_plugin_failure");
+    CHECK(bus->connect(missing.get()));
+    CHECK(bus->connect(failing.get()));
+    CHECK(!missing->failed());
+    CHECK(!failing->failed());
+
+    // the failure is remembered, the libraries are not loaded again
+    for (int i = 0; i < 3; i++) {
+        CHECK(bus->cast<IMissing>() == nullptr);
+        CHECK(missing->failed());
+        CHECK(failing->failed());
+        CHECK(!missing->loaded());
+        CHECK(!failing->loaded());
+    }
+
+    bus->finish();
+}
+
+TEST_CASE("plugin-manifest", tag)
+{
+    using namespace xp;
+
+    const auto names = read_iid_manifest(XP_TEST_PLUGIN);
+#if defined(__linux__)
+    REQUIRE(names);
+    CHECK(*names == std::vector<std::string>{IGreeter::iid_name()});
+#else
+    CHECK(!names);
+#endif
+    CHECK(!read_iid_manifest(__FILE__));        // not a binary
+    CHECK(!read_iid_manifest("no-such-plugin")); // not a file
+
+    auto_ref bus = new TBus(0);
+    CHECK(bus->connect(new TInterfaceEx<Greeting>()));
+    TPluginRegistry plugins(bus.get());
+    CHECK(!plugins.discover("no-such-plugin"));
+#if defined(__linux__)
+    // registered without being loaded
+    CHECK(plugins.discover(XP_TEST_PLUGIN));
+    CHECK(plugins.size() == 1);
+    CHECK(plugins.loaded() == 0);
+
+    auto_ref<IGreeter> greeter = bus.get();
+    REQUIRE(greeter);
+    CHECK(greeter->greet() == 42);
+    CHECK(plugins.loaded() == 1);
+#endif
+    bus->finish();
+}
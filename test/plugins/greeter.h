@@ -0,0 +1,18 @@
+#ifndef XP_TEST_GREETER_H
+#define XP_TEST_GREETER_H
+
+#include <xputil/intf_defs.h>
+
+// Published by the test plugin
+struct IGreeter : public xp::IInterfaceEx {
+    DECLARE_IID("3f4b8e52-1c6d-4a0e-b7d9-8e2a5c6f0b41");
+    virtual int greet() const = 0;
+};
+
+// Resolved by the test plugin from its hosting bus
+struct IGreeting : public xp::IInterfaceEx {
+    DECLARE_IID("9a0c2e7b-5d3f-4b18-a6e4-1f7c9b2d8e53");
+    virtual int value() const = 0;
+};
+
+#endif
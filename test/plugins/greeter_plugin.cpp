@@ -0,0 +1,33 @@
+#include <xputil/plugin.h>
+
+#include "greeter.h"
+
+namespace {
+class Greeter : public xp::TInterfaceEx<IGreeter>
+{
+public:
+    // the greeting of the host, if any
+    int greet() const override
+    {
+        auto self = const_cast<Greeter*>(this);
+        IInterface* p{nullptr};
+        if (self->queryInterface(IID(IGreeting), &p) != xp::xp_error_code::OK) return 0;
+
+        const int value = static_cast<IGreeting*>(p)->value();
+        p->unref();
+        return value;
+    }
+};
+} // namespace
+
+XP_IID_MANIFEST(IGreeter);
+
+XP_PLUGIN_ENTRY(xp_plugin_entry)
+{
+    return new Greeter();
+}
+
+XP_PLUGIN_ENTRY(xp_plugin_failure)
+{
+    return nullptr;
+}
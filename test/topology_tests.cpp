@@ -0,0 +1,206 @@
+#include <xputil/topology.h>
+
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+
+#include "catch2.h"
+#include "plugins/greeter.h"
+
+namespace {
+constexpr auto tag = "[topology]";
+
+struct IColor : public xp::IInterfaceEx {
+    DECLARE_IID("topology.IColor");
+    virtual int color() const = 0;
+};
+struct IShape : public xp::IInterfaceEx {
+    DECLARE_IID("topology.IShape");
+    virtual int sides() const = 0;
+};
+
+struct Color : IColor {
+    int value;
+    explicit Color(int v) : value(v) {}
+    int color() const override { return value; }
+};
+struct Square : IShape {
+    int sides() const override { return 4; }
+};
+struct Greeting : IGreeting {
+    int value() const override { return 7; }
+};
+
+// advertising its IIDs, saved with them
+template <typename T>
+struct Advertised : xp::TInterfaceEx<T>, xp::TIntfManifest<T> {
+    using xp::TInterfaceEx<T>::TInterfaceEx;
+};
+
+// resolves the IIDs of a saved service, each color being its order
+xp::IInterfaceEx* create(const xp::topology_service& s)
+{
+    if (s.iids.size() != 1) return nullptr;
+    if (s.iids[0] == IID(IColor)) return new Advertised<Color>(s.order);
+    if (s.iids[0] == IID(IShape)) return new Advertised<Square>();
+    if (s.iids[0] == IID(IGreeting)) return new Advertised<Greeting>();
+    return nullptr;
+}
+
+// A manifest of buses and links only, made by hand
+std::vector<char> raw_manifest(const std::vector<xp::detail::topology_format::bus>& buses, const std::vector<xp::detail::topology_format::link>& links)
+{
+    namespace fmt = xp::detail::topology_format;
+
+    fmt::header h{};
+    std::memcpy(h.magic, fmt::signature, sizeof(h.magic));
+    h.version = fmt::version;
+    h.buses = static_cast<std::uint32_t>(buses.size());
+    h.links = static_cast<std::uint32_t>(links.size());
+
+    std::vector<char> out(reinterpret_cast<const char*>(&h), reinterpret_cast<const char*>(&h + 1));
+    out.insert(out.end(), reinterpret_cast<const char*>(buses.data()), reinterpret_cast<const char*>(buses.data() + buses.size()));
+    out.insert(out.end(), reinterpret_cast<const char*>(links.data()), reinterpret_cast<const char*>(links.data() + links.size()));
+    return out;
+}
+
+int color_of(xp::IBus* bus)
+{
+    xp::auto_ref<IColor> color = bus;
+    return color ? color->color() : -1;
+}
+} // namespace
+
+TEST_CASE("topology", tag)
+{
+    using namespace xp;
+
+    // root (0) <-> peer (0), root <- module (1) <- util (2), peer <- util
+    auto_ref root = new TBus(0);
+    auto_ref peer = new TBus(0);
+    auto_ref module = new TBus(1);
+    auto_ref util = new TBus(2);
+    CHECK(root->connect(peer));
+    CHECK(root->connect(module));
+    CHECK(module->connect(util));
+    CHECK(peer->connect(util));
+
+    CHECK(peer->connect(new Advertised<Color>(1), 1));
+    CHECK(module->connect(new Advertised<Color>(0), 0));
+    CHECK(module->connect(new Advertised<Square>(), 2));
+    CHECK(module->connectRanked(new Advertised<Color>(3), 5, 3));
+    CHECK(color_of(module.get()) == 3);
+    CHECK(util->connect(new Advertised<Greeting>()));
+    TPluginRegistry plugins(util.get());
+    CHECK(plugins.add({IID(IGreeter)}, XP_TEST_PLUGIN));
+
+    const auto manifest = export_topology(*root);
+    REQUIRE(manifest);
+
+    // a foreign bus is not exported
+    {
+        struct OtherBus : TBus {
+            using TBus::TBus;
+        };
+        auto_ref other = new OtherBus(3);
+        CHECK(util->connect(other));
+        CHECK(!export_topology(*root));
+        CHECK(export_topology(*peer) == std::nullopt);
+        util->disconnect(other);
+        other->finish();
+    }
+
+    const auto path = (std::filesystem::temp_directory_path() / "xp_topology_test.bin").string();
+    REQUIRE(save_topology(*root, path));
+
+    for (bool from_file : {false, true}) {
+        auto buses = from_file ? load_topology(path, create) : import_topology(*manifest, create);
+        REQUIRE(buses.size() == 4);
+
+        auto& root2 = buses[0];
+        CHECK(root2->level() == 0);
+        CHECK(root2->total_siblings() == 1);
+        CHECK(root2->total_buses() == 1);
+
+        // resolved as before, in search order
+        const std::vector<IBus*> saved{root.get(), module.get(), peer.get(), util.get()};
+        for (std::size_t i = 0; i < buses.size(); i++) {
+            CHECK(buses[i]->level() == saved[i]->level());
+            CHECK(color_of(buses[i].get()) == color_of(saved[i]));
+        }
+        CHECK(color_of(root2.get()) == 1); // the sibling first
+
+        // the same graph, saved again
+        CHECK(export_topology(*root2) == manifest);
+
+        // the plugin entry is restored, loaded on demand
+        auto_ref<IGreeter> greeter = root2.get();
+        REQUIRE(greeter);
+        CHECK(greeter->greet() == 7);
+
+        auto_ref<IShape> shape = root2.get();
+        CHECK(shape->sides() == 4);
+
+        for (auto& bus : buses) bus->finish();
+    }
+    std::remove(path.c_str());
+
+    // invalid manifests
+    CHECK(import_topology({}).empty());
+    CHECK(load_topology("no-such-topology").empty());
+    auto broken = *manifest;
+    broken.resize(broken.size() - 8);
+    CHECK(import_topology(broken).empty());
+    broken = *manifest;
+    broken[8] = 99; // version
+    CHECK(import_topology(broken).empty());
+
+    root->finish();
+    peer->finish();
+}
+
+TEST_CASE("topology-malformed", tag)
+{
+    using namespace xp;
+    namespace fmt = detail::topology_format;
+
+    // two sibling buses
+    const std::vector<fmt::bus> siblings{{0, 0, 0, 0, 0, 1}, {0, 0, 0, 1, 0, 1}};
+    const auto valid = raw_manifest(siblings, {1, 0});
+    {
+        auto buses = import_topology(valid);
+        REQUIRE(buses.size() == 2);
+        CHECK(buses[0]->total_siblings() == 1);
+        for (auto& bus : buses) bus->finish();
+    }
+
+    SECTION("truncated header")
+    {
+        CHECK(import_topology(std::span<const char>(valid).first(sizeof(fmt::header) - 1)).empty());
+    }
+
+    SECTION("links out of range")
+    {
+        auto buses = siblings;
+        buses[1].first_link = 1000; // checked before the first bus looks for itself among its siblings
+        CHECK(import_topology(raw_manifest(buses, {1, 0})).empty());
+
+        buses = siblings;
+        buses[1].siblings = 2;
+        CHECK(import_topology(raw_manifest(buses, {1, 0})).empty());
+    }
+
+    SECTION("overflowing counts")
+    {
+        auto buses = siblings;
+        buses[1].uppers = ~std::uint32_t{0}; // uppers + siblings wraps to 0 in 32 bits
+        CHECK(import_topology(raw_manifest(buses, {1, 0})).empty());
+
+        auto manifest = valid;
+        fmt::header h;
+        std::memcpy(&h, manifest.data(), sizeof(h));
+        h.links = ~std::uint32_t{0};
+        std::memcpy(manifest.data(), &h, sizeof(h));
+        CHECK(import_topology(manifest).empty());
+    }
+}